@@ -0,0 +1,912 @@
+/*
+    Coefficient rings for the Lie algebra library.
+
+    Term, Expression and LieAlgebra are parameterized on the type of their coefficients.
+    Besides double, the following are provided:
+        Rational
+            Exact rational numbers. Values whose numerator and denominator fit in 64 bits
+            are computed with machine integers; larger values fall back to BigInt.
+        ModP<p>
+            Integers modulo a prime p < 2^63, using 64-bit arithmetic (with 128-bit products).
+            Mod61 is the Mersenne prime 2^61-1.
+
+    A coefficient type C needs the usual arithmetic operators (+,-,*,/ and unary -),
+    ==, !=, construction from an int, printing with <<, and a CoefTraits<C> specialization.
+    parseCoefficient reads decimal literals, rejecting exponents the type cannot hold
+    (CoefTraits<C>::maxExponent) with ExponentOutOfRange.
+*/
+#ifndef __COEFFICIENTS_H__
+#define __COEFFICIENTS_H__
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <exception>
+#include <cmath>
+#include <cstdlib>
+#include <stdint.h>
+#include <cstring>
+
+class DivisionByZero: public std::exception{
+    public:
+        virtual const char* what() const throw(){
+            return "Division by zero";
+        }
+};
+
+class ExponentOutOfRange: public std::exception{
+    public:
+        virtual const char* what() const throw(){
+            return "Exponent out of range for the coefficient type";
+        }
+};
+
+////////////////////////////////////////////////////////////////
+////// Arbitrary precision integers
+////////////////////////////////////////////////////////////////
+
+// Sign and magnitude, the magnitude stored in base 2^32 with the least significant limb first.
+// Only what Rational needs is provided.
+class BigInt{
+    private:
+        std::vector<uint32_t> mag; // no leading zero limbs; empty for 0
+        bool neg;
+
+        void trim(){
+            while (!mag.empty() && mag.back()==0) mag.pop_back();
+            if (mag.empty()) neg=false;
+        }
+
+        static int cmpMag(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b){
+            if (a.size()!=b.size()) return a.size()<b.size() ? -1 : 1;
+            for (int i=(int)a.size()-1;i>=0;i--){
+                if (a[i]!=b[i]) return a[i]<b[i] ? -1 : 1;
+            }
+            return 0;
+        }
+
+        static std::vector<uint32_t> addMag(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b){
+            std::vector<uint32_t> r(std::max(a.size(),b.size())+1);
+            uint64_t carry=0;
+            for (size_t i=0;i<r.size();i++){
+                uint64_t t=carry;
+                if (i<a.size()) t+=a[i];
+                if (i<b.size()) t+=b[i];
+                r[i]=(uint32_t)t;
+                carry=t>>32;
+            }
+            return r;
+        }
+
+        // a-b, requires |a|>=|b|
+        static std::vector<uint32_t> subMag(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b){
+            std::vector<uint32_t> r(a.size());
+            int64_t borrow=0;
+            for (size_t i=0;i<a.size();i++){
+                int64_t t=(int64_t)a[i]-borrow-(i<b.size() ? (int64_t)b[i] : 0);
+                borrow=0;
+                if (t<0){
+                    t+=(int64_t)1<<32;
+                    borrow=1;
+                }
+                r[i]=(uint32_t)t;
+            }
+            return r;
+        }
+
+        static std::vector<uint32_t> mulMag(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b){
+            if (a.empty() || b.empty()) return std::vector<uint32_t>();
+            std::vector<uint32_t> r(a.size()+b.size());
+            for (size_t i=0;i<a.size();i++){
+                uint64_t carry=0;
+                for (size_t j=0;j<b.size();j++){
+                    uint64_t t=(uint64_t)a[i]*b[j]+r[i+j]+carry;
+                    r[i+j]=(uint32_t)t;
+                    carry=t>>32;
+                }
+                r[i+b.size()]=(uint32_t)carry;
+            }
+            return r;
+        }
+
+        // Knuth's algorithm D: a=q*b+r with 0<=r<b. b must be nonzero.
+        static void divMag(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b,
+                           std::vector<uint32_t>& q, std::vector<uint32_t>& r){
+            if (cmpMag(a,b)<0){
+                q.clear();
+                r=a;
+                return;
+            }
+            size_t n=b.size(), m=a.size()-n;
+            q.assign(m+1,0);
+            if (n==1){
+                uint64_t rem=0;
+                for (int i=(int)a.size()-1;i>=0;i--){
+                    uint64_t cur=(rem<<32)|a[i];
+                    q[i]=(uint32_t)(cur/b[0]);
+                    rem=cur%b[0];
+                }
+                r.assign(1,(uint32_t)rem);
+                return;
+            }
+            int s=__builtin_clz(b.back());
+            std::vector<uint32_t> vn(n), un(a.size()+1);
+            for (size_t i=n-1;i>0;i--) vn[i]=(b[i]<<s)|(s ? (uint32_t)((uint64_t)b[i-1]>>(32-s)) : 0);
+            vn[0]=b[0]<<s;
+            un[a.size()]=s ? (uint32_t)((uint64_t)a.back()>>(32-s)) : 0;
+            for (size_t i=a.size()-1;i>0;i--) un[i]=(a[i]<<s)|(s ? (uint32_t)((uint64_t)a[i-1]>>(32-s)) : 0);
+            un[0]=a[0]<<s;
+            const uint64_t base=(uint64_t)1<<32;
+            for (int j=(int)m;j>=0;j--){
+                uint64_t num=((uint64_t)un[j+n]<<32)|un[j+n-1];
+                uint64_t qhat=num/vn[n-1];
+                uint64_t rhat=num%vn[n-1];
+                while (qhat>=base || qhat*vn[n-2]>((rhat<<32)|un[j+n-2])){
+                    qhat--;
+                    rhat+=vn[n-1];
+                    if (rhat>=base) break;
+                }
+                int64_t k=0, t;
+                for (size_t i=0;i<n;i++){
+                    uint64_t p=qhat*vn[i];
+                    t=(int64_t)un[i+j]-k-(int64_t)(p&0xFFFFFFFFULL);
+                    un[i+j]=(uint32_t)t;
+                    k=(int64_t)(p>>32)-(t>>32);
+                }
+                t=(int64_t)un[j+n]-k;
+                un[j+n]=(uint32_t)t;
+                q[j]=(uint32_t)qhat;
+                if (t<0){
+                    q[j]--;
+                    uint64_t c=0;
+                    for (size_t i=0;i<n;i++){
+                        uint64_t u=(uint64_t)un[i+j]+vn[i]+c;
+                        un[i+j]=(uint32_t)u;
+                        c=u>>32;
+                    }
+                    un[j+n]+=(uint32_t)c;
+                }
+            }
+            r.assign(n,0);
+            for (size_t i=0;i<n;i++){
+                r[i]=(un[i]>>s)|(s ? (uint32_t)((uint64_t)un[i+1]<<(32-s)) : 0);
+            }
+        }
+
+    public:
+        BigInt():neg(false){}
+
+        BigInt(long long v):neg(v<0){
+            unsigned long long u=v<0 ? 0ULL-(unsigned long long)v : (unsigned long long)v;
+            while (u){
+                mag.push_back((uint32_t)u);
+                u>>=32;
+            }
+        }
+
+        BigInt(__int128 v):neg(v<0){
+            unsigned __int128 u=v<0 ? (unsigned __int128)0-(unsigned __int128)v : (unsigned __int128)v;
+            while (u){
+                mag.push_back((uint32_t)u);
+                u>>=32;
+            }
+        }
+
+        // Parses an optionally signed string of decimal digits
+        static BigInt fromString(const std::string& s){
+            BigInt r;
+            size_t i=0;
+            bool negative=false;
+            if (i<s.size() && (s[i]=='-' || s[i]=='+')){
+                negative=s[i]=='-';
+                i++;
+            }
+            for (;i<s.size();){
+                size_t len=std::min((size_t)9,s.size()-i);
+                long long chunk=0, scale=1;
+                for (size_t k=0;k<len;k++){
+                    chunk=chunk*10+(s[i+k]-'0');
+                    scale*=10;
+                }
+                r=r*BigInt(scale)+BigInt(chunk);
+                i+=len;
+            }
+            if (negative) r=-r;
+            return r;
+        }
+
+        bool isZero() const{
+            return mag.empty();
+        }
+
+        bool isNegative() const{
+            return neg;
+        }
+
+        // True if the value fits in a signed 64-bit integer
+        bool fitsInt64() const{
+            if (mag.size()>2) return false;
+            uint64_t u=toMag64();
+            return neg ? u<=(uint64_t)1<<63 : u<((uint64_t)1<<63);
+        }
+
+        long long toInt64() const{
+            uint64_t u=toMag64();
+            return neg ? (long long)(0ULL-u) : (long long)u;
+        }
+
+        uint64_t toMag64() const{
+            uint64_t u=0;
+            if (mag.size()>0) u=mag[0];
+            if (mag.size()>1) u|=(uint64_t)mag[1]<<32;
+            return u;
+        }
+
+        double toDouble() const{
+            double d=0;
+            for (int i=(int)mag.size()-1;i>=0;i--) d=d*4294967296.0+mag[i];
+            return neg ? -d : d;
+        }
+
+        BigInt operator-() const{
+            BigInt r=*this;
+            if (!r.mag.empty()) r.neg=!r.neg;
+            return r;
+        }
+
+        BigInt abs() const{
+            BigInt r=*this;
+            r.neg=false;
+            return r;
+        }
+
+        BigInt operator+(const BigInt& rhs) const{
+            BigInt r;
+            if (neg==rhs.neg){
+                r.mag=addMag(mag,rhs.mag);
+                r.neg=neg;
+            }
+            else if (cmpMag(mag,rhs.mag)>=0){
+                r.mag=subMag(mag,rhs.mag);
+                r.neg=neg;
+            }
+            else{
+                r.mag=subMag(rhs.mag,mag);
+                r.neg=rhs.neg;
+            }
+            r.trim();
+            return r;
+        }
+
+        BigInt operator-(const BigInt& rhs) const{
+            return *this+(-rhs);
+        }
+
+        BigInt operator*(const BigInt& rhs) const{
+            BigInt r;
+            r.mag=mulMag(mag,rhs.mag);
+            r.neg=neg!=rhs.neg;
+            r.trim();
+            return r;
+        }
+
+        // Truncating division, as for machine integers
+        void divmod(const BigInt& rhs, BigInt& q, BigInt& r) const{
+            if (rhs.isZero()) throw DivisionByZero();
+            std::vector<uint32_t> qm, rm;
+            divMag(mag,rhs.mag,qm,rm);
+            q.mag=qm;
+            q.neg=neg!=rhs.neg;
+            q.trim();
+            r.mag=rm;
+            r.neg=neg;
+            r.trim();
+        }
+
+        BigInt operator/(const BigInt& rhs) const{
+            BigInt q, r;
+            divmod(rhs,q,r);
+            return q;
+        }
+
+        BigInt operator%(const BigInt& rhs) const{
+            BigInt q, r;
+            divmod(rhs,q,r);
+            return r;
+        }
+
+        bool operator==(const BigInt& rhs) const{
+            return neg==rhs.neg && mag==rhs.mag;
+        }
+
+        bool operator!=(const BigInt& rhs) const{
+            return !(*this==rhs);
+        }
+
+        bool operator<(const BigInt& rhs) const{
+            if (neg!=rhs.neg) return neg;
+            int c=cmpMag(mag,rhs.mag);
+            return neg ? c>0 : c<0;
+        }
+
+        static BigInt gcd(BigInt a, BigInt b){
+            a.neg=false;
+            b.neg=false;
+            while (!b.isZero()){
+                BigInt t=a%b;
+                a=b;
+                b=t;
+            }
+            return a;
+        }
+
+        std::string toString() const{
+            if (mag.empty()) return "0";
+            std::string digits;
+            BigInt cur=abs(), q, r;
+            BigInt ten9(1000000000LL);
+            while (!cur.isZero()){
+                cur.divmod(ten9,q,r);
+                long long chunk=r.toInt64();
+                for (int k=0;k<9;k++){
+                    digits+=(char)('0'+chunk%10);
+                    chunk/=10;
+                    if (q.isZero() && chunk==0) break;
+                }
+                cur=q;
+            }
+            if (neg) digits+='-';
+            return std::string(digits.rbegin(),digits.rend());
+        }
+};
+
+////////////////////////////////////////////////////////////////
+////// Rationals
+////////////////////////////////////////////////////////////////
+
+// Exact rational number, always in lowest terms with a positive denominator.
+// Small values are held as a pair of 64-bit integers; arithmetic on them is done with
+// 128-bit intermediates and only falls back to BigInt when the result does not fit.
+class Rational{
+    private:
+        struct Big{
+            BigInt num, den;
+        };
+        long long n, d; // valid when big==0
+        Big* big;
+
+        static __int128 gcd128(__int128 a, __int128 b){
+            if (a<0) a=-a;
+            if (b<0) b=-b;
+            while (b){
+                __int128 t=a%b;
+                a=b;
+                b=t;
+            }
+            return a;
+        }
+
+        static bool fits(__int128 v){
+            return v>=-(__int128)0x7FFFFFFFFFFFFFFFLL && v<=(__int128)0x7FFFFFFFFFFFFFFFLL;
+        }
+
+        // Sets the value to num/den, den>0, reducing and picking the representation
+        void set128(__int128 num, __int128 den){
+            if (den<0){
+                num=-num;
+                den=-den;
+            }
+            __int128 g=gcd128(num,den);
+            if (g>1){
+                num/=g;
+                den/=g;
+            }
+            if (num==0) den=1;
+            if (fits(num) && fits(den)) setSmall((long long)num,(long long)den);
+            else setBig(BigInt(num),BigInt(den));
+        }
+
+        void setSmall(long long num, long long den){
+            delete big;
+            big=0;
+            n=num;
+            d=den;
+        }
+
+        // Sets the value to num/den, den!=0, reducing and demoting to the small form if possible
+        void setBig(BigInt num, BigInt den){
+            if (den.isNegative()){
+                num=-num;
+                den=-den;
+            }
+            BigInt g=BigInt::gcd(num,den);
+            if (g!=BigInt(1LL) && !g.isZero()){
+                num=num/g;
+                den=den/g;
+            }
+            if (num.isZero()) den=BigInt(1LL);
+            if (num.fitsInt64() && den.fitsInt64() && num.toInt64()!=(long long)0x8000000000000000ULL){
+                setSmall(num.toInt64(),den.toInt64());
+                return;
+            }
+            if (!big) big=new Big;
+            big->num=num;
+            big->den=den;
+        }
+
+        BigInt bigNum() const{
+            return big ? big->num : BigInt(n);
+        }
+
+        BigInt bigDen() const{
+            return big ? big->den : BigInt(d);
+        }
+
+    public:
+        Rational():n(0),d(1),big(0){}
+
+        Rational(int v):n(v),d(1),big(0){}
+
+        Rational(long long v):n(v),d(1),big(0){}
+
+        Rational(long long num, long long den):n(0),d(1),big(0){
+            if (den==0) throw DivisionByZero();
+            set128(num,den);
+        }
+
+        Rational(const BigInt& num, const BigInt& den):n(0),d(1),big(0){
+            if (den.isZero()) throw DivisionByZero();
+            setBig(num,den);
+        }
+
+        Rational(const Rational& rhs):n(rhs.n),d(rhs.d),big(0){
+            if (rhs.big) big=new Big(*rhs.big);
+        }
+
+        Rational(Rational&& rhs):n(rhs.n),d(rhs.d),big(rhs.big){
+            rhs.big=0;
+        }
+
+        ~Rational(){
+            delete big;
+        }
+
+        Rational& operator=(const Rational& rhs){
+            if (this==&rhs) return *this;
+            if (rhs.big) setBig(rhs.big->num,rhs.big->den);
+            else setSmall(rhs.n,rhs.d);
+            return *this;
+        }
+
+        Rational& operator=(Rational&& rhs){
+            if (this==&rhs) return *this;
+            delete big;
+            n=rhs.n;
+            d=rhs.d;
+            big=rhs.big;
+            rhs.big=0;
+            return *this;
+        }
+
+        bool isSmall() const{
+            return big==0;
+        }
+
+        BigInt numerator() const{
+            return bigNum();
+        }
+
+        BigInt denominator() const{
+            return bigDen();
+        }
+
+        Rational operator-() const{
+            Rational r;
+            if (big) r.setBig(-big->num,big->den);
+            else r.set128(-(__int128)n,d);
+            return r;
+        }
+
+        Rational operator+(const Rational& rhs) const{
+            Rational r;
+            if (!big && !rhs.big){
+                if (d==rhs.d) r.set128((__int128)n+rhs.n,d);
+                else r.set128((__int128)n*rhs.d+(__int128)rhs.n*d,(__int128)d*rhs.d);
+            }
+            else r.setBig(bigNum()*rhs.bigDen()+rhs.bigNum()*bigDen(),bigDen()*rhs.bigDen());
+            return r;
+        }
+
+        Rational operator-(const Rational& rhs) const{
+            return *this+(-rhs);
+        }
+
+        Rational operator*(const Rational& rhs) const{
+            Rational r;
+            if (!big && !rhs.big){
+                if (d==1 && rhs.d==1) r.set128((__int128)n*rhs.n,1);
+                else r.set128((__int128)n*rhs.n,(__int128)d*rhs.d);
+            }
+            else r.setBig(bigNum()*rhs.bigNum(),bigDen()*rhs.bigDen());
+            return r;
+        }
+
+        Rational operator/(const Rational& rhs) const{
+            if (rhs==Rational()) throw DivisionByZero();
+            Rational r;
+            if (!big && !rhs.big) r.set128((__int128)n*rhs.d,(__int128)d*rhs.n);
+            else r.setBig(bigNum()*rhs.bigDen(),bigDen()*rhs.bigNum());
+            return r;
+        }
+
+        Rational& operator+=(const Rational& rhs){
+            return *this=*this+rhs;
+        }
+
+        Rational& operator-=(const Rational& rhs){
+            return *this=*this-rhs;
+        }
+
+        Rational& operator*=(const Rational& rhs){
+            return *this=*this*rhs;
+        }
+
+        Rational& operator/=(const Rational& rhs){
+            return *this=*this/rhs;
+        }
+
+        bool operator==(const Rational& rhs) const{
+            if (!big && !rhs.big) return n==rhs.n && d==rhs.d;
+            if (!big || !rhs.big) return false; // representations are canonical
+            return big->num==rhs.big->num && big->den==rhs.big->den;
+        }
+
+        bool operator!=(const Rational& rhs) const{
+            return !(*this==rhs);
+        }
+
+        bool operator<(const Rational& rhs) const{
+            if (!big && !rhs.big) return (__int128)n*rhs.d<(__int128)rhs.n*d;
+            return bigNum()*rhs.bigDen()<rhs.bigNum()*bigDen();
+        }
+
+        double toDouble() const{
+            if (!big) return (double)n/(double)d;
+            return big->num.toDouble()/big->den.toDouble();
+        }
+
+        std::string toString() const{
+            std::stringstream ss;
+            if (!big){
+                ss<<n;
+                if (d!=1) ss<<"/"<<d;
+                return ss.str();
+            }
+            std::string s=big->num.toString();
+            if (big->den!=BigInt(1LL)) s+="/"+big->den.toString();
+            return s;
+        }
+};
+
+inline std::ostream& operator<<(std::ostream& os, const Rational& q){
+    return os<<q.toString();
+}
+
+////////////////////////////////////////////////////////////////
+////// Integers modulo a prime
+////////////////////////////////////////////////////////////////
+
+// Residues modulo the prime P (P<2^63). Products are taken in 128 bits and reduced.
+template <uint64_t P>
+class ModP{
+    private:
+        uint64_t v; // 0<=v<P
+
+        static uint64_t reduce(long long x){
+            long long r=x%(long long)P;
+            return r<0 ? (uint64_t)(r+(long long)P) : (uint64_t)r;
+        }
+
+    public:
+        ModP():v(0){}
+
+        ModP(int x):v(reduce(x)){}
+
+        ModP(long long x):v(reduce(x)){}
+
+        static ModP fromResidue(uint64_t r){
+            ModP m;
+            m.v=r%P;
+            return m;
+        }
+
+        static uint64_t modulus(){
+            return P;
+        }
+
+        uint64_t residue() const{
+            return v;
+        }
+
+        ModP operator-() const{
+            return fromResidue(v==0 ? 0 : P-v);
+        }
+
+        ModP operator+(const ModP& rhs) const{
+            uint64_t s=v+rhs.v;
+            if (s>=P) s-=P;
+            return fromResidue(s);
+        }
+
+        ModP operator-(const ModP& rhs) const{
+            return fromResidue(v>=rhs.v ? v-rhs.v : v+P-rhs.v);
+        }
+
+        ModP operator*(const ModP& rhs) const{
+            return fromResidue((uint64_t)((unsigned __int128)v*rhs.v%P));
+        }
+
+        ModP pow(uint64_t e) const{
+            ModP r(1), b=*this;
+            while (e){
+                if (e&1) r=r*b;
+                b=b*b;
+                e>>=1;
+            }
+            return r;
+        }
+
+        // Multiplicative inverse, by Fermat's little theorem
+        ModP inverse() const{
+            if (v==0) throw DivisionByZero();
+            return pow(P-2);
+        }
+
+        ModP operator/(const ModP& rhs) const{
+            return *this*rhs.inverse();
+        }
+
+        ModP& operator+=(const ModP& rhs){
+            return *this=*this+rhs;
+        }
+
+        ModP& operator-=(const ModP& rhs){
+            return *this=*this-rhs;
+        }
+
+        ModP& operator*=(const ModP& rhs){
+            return *this=*this*rhs;
+        }
+
+        ModP& operator/=(const ModP& rhs){
+            return *this=*this/rhs;
+        }
+
+        bool operator==(const ModP& rhs) const{
+            return v==rhs.v;
+        }
+
+        bool operator!=(const ModP& rhs) const{
+            return v!=rhs.v;
+        }
+
+        // Prints the residue closest to zero, so small negative numbers read naturally
+        std::string toString() const{
+            std::stringstream ss;
+            if (v>P/2) ss<<"-"<<(P-v);
+            else ss<<v;
+            return ss.str();
+        }
+};
+
+template <uint64_t P>
+std::ostream& operator<<(std::ostream& os, const ModP<P>& m){
+    return os<<m.toString();
+}
+
+typedef ModP<2305843009213693951ULL> Mod61; // 2^61-1
+
+////////////////////////////////////////////////////////////////
+////// Coefficient traits
+////////////////////////////////////////////////////////////////
+
+// CoefTraits<C>::isZero(c)
+//     Whether c is to be treated as zero (exact, except for double).
+// CoefTraits<C>::fromInteger(digits)
+//     The value of a nonnegative decimal integer literal.
+// CoefTraits<C>::name()
+//     Identifies the ring in binary algebra files.
+// CoefTraits<C>::write(out, c) and CoefTraits<C>::read(p, end, c)
+//     Append the binary encoding of c to out, and decode one value at p (advancing p).
+//     read returns false if the data at p is truncated or invalid.
+template <class C> struct CoefTraits;
+
+// Fixed width little-endian encoding shared by the binary readers and writers
+inline void putBytes(std::string& out, const void* data, size_t n){
+    out.append((const char*)data,n);
+}
+
+inline bool getBytes(const char*& p, const char* end, void* data, size_t n){
+    if ((size_t)(end-p)<n) return false;
+    memcpy(data,p,n);
+    p+=n;
+    return true;
+}
+
+inline void putString(std::string& out, const std::string& s){
+    uint32_t n=s.size();
+    putBytes(out,&n,sizeof(n));
+    out+=s;
+}
+
+inline bool getString(const char*& p, const char* end, std::string& s){
+    uint32_t n;
+    if (!getBytes(p,end,&n,sizeof(n)) || (size_t)(end-p)<n) return false;
+    s.assign(p,n);
+    p+=n;
+    return true;
+}
+
+template <> struct CoefTraits<double>{
+    static bool isZero(const double& c){
+        return fabs(c)<=0.00000001;
+    }
+    static double fromInteger(const std::string& digits){
+        return strtod(digits.c_str(),0);
+    }
+    // Largest decimal exponent parseCoefficient accepts; larger values overflow anyway
+    static long maxExponent(){
+        return 308;
+    }
+    static bool isFinite(const double& c){
+        return std::isfinite(c);
+    }
+    static std::string name(){
+        return "double";
+    }
+    static void write(std::string& out, const double& c){
+        putBytes(out,&c,sizeof(c));
+    }
+    static bool read(const char*& p, const char* end, double& c){
+        return getBytes(p,end,&c,sizeof(c));
+    }
+};
+
+template <> struct CoefTraits<Rational>{
+    static bool isZero(const Rational& c){
+        return c==Rational();
+    }
+    static Rational fromInteger(const std::string& digits){
+        return Rational(BigInt::fromString(digits),BigInt(1LL));
+    }
+    // Exact, but 10^maxExponent is already a 3300 bit integer
+    static long maxExponent(){
+        return 1000;
+    }
+    static bool isFinite(const Rational&){
+        return true;
+    }
+    static std::string name(){
+        return "rational";
+    }
+    // A tag byte, then either the 64-bit numerator and denominator or both in decimal
+    static void write(std::string& out, const Rational& c){
+        char big=!c.isSmall();
+        putBytes(out,&big,1);
+        if (!big){
+            long long n=c.numerator().toInt64(), d=c.denominator().toInt64();
+            putBytes(out,&n,sizeof(n));
+            putBytes(out,&d,sizeof(d));
+        }
+        else{
+            putString(out,c.numerator().toString());
+            putString(out,c.denominator().toString());
+        }
+    }
+    static bool read(const char*& p, const char* end, Rational& c){
+        char big;
+        if (!getBytes(p,end,&big,1)) return false;
+        if (!big){
+            long long n, d;
+            if (!getBytes(p,end,&n,sizeof(n)) || !getBytes(p,end,&d,sizeof(d)) || d==0) return false;
+            c=Rational(n,d);
+            return true;
+        }
+        std::string n, d;
+        if (!getString(p,end,n) || !getString(p,end,d)) return false;
+        BigInt den=BigInt::fromString(d);
+        if (den.isZero()) return false;
+        c=Rational(BigInt::fromString(n),den);
+        return true;
+    }
+};
+
+template <uint64_t P> struct CoefTraits<ModP<P> >{
+    static bool isZero(const ModP<P>& c){
+        return c.residue()==0;
+    }
+    static ModP<P> fromInteger(const std::string& digits){
+        ModP<P> r, ten(10);
+        for (size_t i=0;i<digits.size();i++){
+            r=r*ten+ModP<P>(digits[i]-'0');
+        }
+        return r;
+    }
+    static long maxExponent(){
+        return 1000;
+    }
+    static bool isFinite(const ModP<P>&){
+        return true;
+    }
+    static std::string name(){
+        std::stringstream ss;
+        ss<<"mod "<<P;
+        return ss.str();
+    }
+    static void write(std::string& out, const ModP<P>& c){
+        uint64_t r=c.residue();
+        putBytes(out,&r,sizeof(r));
+    }
+    static bool read(const char*& p, const char* end, ModP<P>& c){
+        uint64_t r;
+        if (!getBytes(p,end,&r,sizeof(r)) || r>=P) return false;
+        c=ModP<P>::fromResidue(r);
+        return true;
+    }
+};
+
+// Parses an unsigned numeric literal at the start of s: digits, an optional fractional part,
+// an optional decimal exponent and an optional /denominator (e.g. 3, 0.25, 1.5e-3, 1/3, 2.5/7).
+// Sets *length to the number of characters read, 0 if s does not start with a digit.
+// Throws ExponentOutOfRange if the exponent is above CoefTraits<C>::maxExponent() or the value
+// is not finite.
+template <class C>
+C parseCoefficient(const std::string& s, size_t* length){
+    size_t i=0;
+    std::string digits;
+    while (i<s.size() && '0'<=s[i] && s[i]<='9') digits+=s[i++];
+    if (i==0){
+        *length=0;
+        return C(1);
+    }
+    long shift=0;  // power of ten the digits are multiplied by
+    if (i<s.size() && s[i]=='.'){
+        i++;
+        while (i<s.size() && '0'<=s[i] && s[i]<='9'){
+            digits+=s[i++];
+            shift--;
+        }
+    }
+    if (i<s.size() && (s[i]=='e' || s[i]=='E')){
+        size_t j=i+1;
+        bool negative=false;
+        if (j<s.size() && (s[j]=='+' || s[j]=='-')) negative=(s[j++]=='-');
+        if (j<s.size() && '0'<=s[j] && s[j]<='9'){
+            long exponent=0;
+            while (j<s.size() && '0'<=s[j] && s[j]<='9'){
+                exponent=exponent*10+(s[j]-'0');
+                if (exponent>CoefTraits<C>::maxExponent()) throw ExponentOutOfRange();
+                j++;
+            }
+            shift+=negative ? -exponent : exponent;
+            i=j;
+        }
+    }
+    if (shift>0) digits.append(shift,'0');
+    C value=CoefTraits<C>::fromInteger(digits);
+    if (shift<0) value=value/CoefTraits<C>::fromInteger("1"+std::string(-shift,'0'));
+    if (i+1<s.size() && s[i]=='/' && '0'<=s[i+1] && s[i+1]<='9'){
+        i++;
+        std::string den;
+        while (i<s.size() && '0'<=s[i] && s[i]<='9') den+=s[i++];
+        C denominator=CoefTraits<C>::fromInteger(den);
+        if (CoefTraits<C>::isZero(denominator)) throw DivisionByZero();
+        value=value/denominator;
+    }
+    if (!CoefTraits<C>::isFinite(value)) throw ExponentOutOfRange();
+    *length=i;
+    return value;
+}
+
+#endif
@@ -10,17 +10,42 @@
         LieAlgebra::LieAlgebra(filename)
             Constructs a Lie-like algebra according to description in filename
         LieAlgebra::Simplify(expression)
-            "Simplifies" expression, with the property that zero expressions will always be recognized.
+            Rewrites expression into its PBW normal form, so zero expressions will always be recognized.
         Expression::symmetrize()
             returns the symmetrization of the expression
+        LieAlgebra::symmetrize(expression)
+            returns the symmetrization of the expression in normal form
         LieAlgebra::checkJacobi()
             Checks if described algebra satisfies the Jacobi identity
+        LieAlgebra::killingForm(), LieAlgebra::adjointMatrix(i)
+            For algebras whose brackets are linear in the basis, the Killing form and ad x_i as matrices
+        LieAlgebra::casimir(), LieAlgebra::casimir(form)
+            Computes the quadratic Casimir element of the Killing form or of a given invariant form
         LieAlgebra::commutator(Expression 1, Expression 2)    
             Computes the commutator of expression 1 and expression 2
         LieAlgebra::fromString(string)
             Parses a string to extract an expression
         LieAlgebra::SymmetricAlgebra()
             Constructs the symmetric algebra with the same generators as given algebra.
+        LieAlgebra::toPolynomial(expression), LieAlgebra::fromPolynomial(polynomial)
+            Converts between expressions and commutative polynomials in the basis (see Polynomial.h)
+        LieAlgebra::poisson(polynomial 1, polynomial 2)
+            Computes the Poisson bracket of two polynomials in the symmetric algebra
+        LieAlgebra::center(degree)
+            Computes a basis of the central elements up to the given degree
+        LieAlgebra::power(expression, n), LieAlgebra::product(expressions)
+            Computes powers and products in normal form, choosing the order of multiplication
+        LieAlgebra::adjointAction(i, degree), LieAlgebra::coordinates(expression, degree)
+            Cached sparse matrices of ad x_i on the monomials up to a given degree, and coordinates on them
+        LieAlgebra::setTruncation(truncation)
+            Keeps only terms up to a given degree, or only the top-degree part, of results
+        LieAlgebra::enableStats(), LieAlgebra::stats()
+            Count rewrite steps and worklist sizes, and time parsing, multiplication and normal ordering.
+    
+    Coefficients:
+        Term, Expression and LieAlgebra use double coefficients. They are typedefs of
+        BasicTerm<C>, BasicExpression<C> and BasicLieAlgebra<C>, which accept any coefficient
+        ring from Coefficients.h, e.g. BasicLieAlgebra<Rational> or BasicLieAlgebra<Mod61>.
     
     TODO- Strip input of all spaces for constructor of LieAlgebra, to be more user friendly.
         
@@ -40,6 +65,26 @@
 #include <cstdlib>
 #include <cstring>
 #include <cstdio>
+#include <cctype>
+#include <unordered_map>
+#include <unordered_set>
+#include <map>
+#include <list>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "Coefficients.h"
+#include "Polynomial.h"
+#include "Linear.h"
+#include "Parallel.h"
 
 using std::string;
 using std::vector;
@@ -52,11 +97,15 @@ using std::stringstream;
 using std::exception;
 
 class BasisE;
-class Term;
-class Expression;
-class LieAlgebra;
+template <class C> class BasicTerm;
+template <class C> class BasicExpression;
+template <class C> class BasicLieAlgebra;
 
-// NOTE: PERMUTATIONS ARE CHECKED USING A HASH FUNCTION. CHECK HASH FUNCTION'S ACCURACY!!!!!!!!!
+// The classes are parameterized on the coefficient ring (see Coefficients.h); these are the
+// double precision versions.
+typedef BasicTerm<double> Term;
+typedef BasicExpression<double> Expression;
+typedef BasicLieAlgebra<double> LieAlgebra;
 
 ////////////////////////////////////////////////////////////
 // Error classes
@@ -69,12 +118,46 @@ class FileNotFound: public exception{
 };
 
 class FormatError: public exception{
+    private:
+        string message;
+    public:
+        int line, column; // 1-based position of the error, 0 if unknown
+        FormatError():message("Incorrect file format."),line(0),column(0){}
+        FormatError(string reason):line(0),column(0){
+            message="Incorrect file format: "+reason;
+        }
+        FormatError(int line, int column, string reason):line(line),column(column){
+            stringstream ss;
+            ss<<"Incorrect file format at line "<<line<<", column "<<column<<": "<<reason;
+            message=ss.str();
+        }
+        virtual ~FormatError() throw(){}
+        virtual const char* what() const throw(){
+            return message.c_str();
+        }    
+};
+
+class FileWriteError: public exception{
     public:
         virtual const char* what() const throw(){
-        return "Incorrect file format.";
+            return "Could not write file.";
         }    
 };
 
+class NotLinear: public exception{
+    public:
+        virtual const char* what() const throw(){
+            return "Brackets are not linear in the basis";
+        }
+};
+
+class DegenerateForm: public exception{
+    public:
+        virtual const char* what() const throw(){
+            return "The bilinear form is degenerate";
+        }
+};
+
 class NoSuchBasis: public exception{
     public:
         virtual const char* what() const throw(){
@@ -89,10 +172,21 @@ class InvalidCoef: public exception{
         }    
 };
 
-class InvalidExpression: exception{
+class InvalidExpression: public exception{
+    private:
+        string message;
     public:
+        int column;     // 1-based position in the parsed string, 0 if unknown
+        string reason;
+        InvalidExpression():message("Invalid expression"),column(0){}
+        InvalidExpression(int column, string reason):column(column),reason(reason){
+            stringstream ss;
+            ss<<"Invalid expression at column "<<column<<": "<<reason;
+            message=ss.str();
+        }
+        virtual ~InvalidExpression() throw(){}
         virtual const char* what() const throw(){
-            return "Invalid expression";
+            return message.c_str();
         }    
 };
 
@@ -104,6 +198,58 @@ bool isDigit(char k){
      return false;
 }
 
+// Read-only view of a whole file. On POSIX systems the file is mapped into memory,
+// elsewhere it is read into a buffer.
+class MappedFile{
+    private:
+        const char* ptr;
+        size_t len;
+        bool mapped;
+        string buffer;
+        MappedFile(const MappedFile&);
+        MappedFile& operator=(const MappedFile&);
+    public:
+        MappedFile(const string& filename):ptr(0),len(0),mapped(false){
+#ifndef _WIN32
+            int fd=open(filename.c_str(),O_RDONLY);
+            if (fd<0) throw FileNotFound();
+            struct stat st;
+            if (fstat(fd,&st)==0 && st.st_size>0){
+                void* m=mmap(0,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+                if (m!=MAP_FAILED){
+                    ptr=(const char*)m;
+                    len=st.st_size;
+                    mapped=true;
+                }
+            }
+            close(fd);
+            if (mapped) return;
+#endif
+            FILE * file = fopen(filename.c_str(), "rb");
+            if (!file) throw FileNotFound();
+            char chunk[1<<16];
+            size_t n;
+            while ((n=fread(chunk,1,sizeof(chunk),file))>0) buffer.append(chunk,n);
+            fclose(file);
+            ptr=buffer.data();
+            len=buffer.size();
+        }
+
+        ~MappedFile(){
+#ifndef _WIN32
+            if (mapped) munmap((void*)ptr,len);
+#endif
+        }
+
+        const char* data() const{
+            return ptr;
+        }
+
+        size_t size() const{
+            return len;
+        }
+};
+
 bool safe_getline(FILE * fp, char* buf) {
     int c;
     int i = 0;
@@ -114,33 +260,19 @@ bool safe_getline(FILE * fp, char* buf) {
 }
 
 
-// Gets the coefficient (8a*b*c => 8). term is mutated.
-void coef(const string term, double* coef, string* remainder){
-    stringstream ss;
-    ss.str(term);
-    int i = 0;
-    if (term[i] == '-'){
-        *coef = -1;
-        i += 1;
-    }
-    else {
-        if ('0' <= term[i] && term[i] <= '9') *coef = 0;
-        else *coef = 1;
-    }
-    while ('0' <= term[i] && term[i] <= '9') {
-        *coef = (*coef) * 10 + (term[i] - '0');
-        i++;
-    }
-    if (term[i] == '.') {
+// Gets the coefficient (8a*b*c => 8, -1/2a*b => -1/2, 0.5a => 0.5). term is not mutated.
+template <class C>
+void coef(const string term, C* coef, string* remainder){
+    size_t i=0, len;
+    bool negative=false;
+    if (i<term.size() && term[i]=='-'){
+        negative=true;
         i++;
-        double j = 10;
-        while ('0' <= term[i] && term[i] <= '9') {
-            *coef += term[i]/j;
-            i++;
-            j *= 10;
-        }
     }
-    *remainder = term.substr(i);
+    *coef=parseCoefficient<C>(term.substr(i),&len);
+    i+=len;
+    if (negative) *coef=-*coef;
+    *remainder=term.substr(i);
 }
 
 void split(string s, char c, vector<string> * result) {
@@ -161,25 +293,406 @@ void split(string s, char c, vector<string> * result) {
 /// Main Code
 ///////////////////////////////////////////////////////////////
 
+/////////////////////////////////////////////////////////////
+////// Symbol table
+// Every basis element name is interned once, process wide, and afterwards
+// referred to by its integer id. Terms only store ids, so comparing, ordering
+// and hashing monomials never touches strings.
+// Any thread may intern (e.g. fromString reading a new name), so every access takes
+// the table's lock. Names live in a deque, so references returned by name() stay
+// valid while other names are added.
+class SymbolTable{
+    private:
+        std::deque<string> names;
+        std::unordered_map<string,int> ids;
+        mutable std::mutex lock;
+        SymbolTable(){}
+    public:
+        static SymbolTable& instance(){
+            static SymbolTable table;
+            return table;
+        }
+
+        // Returns the id of name, adding it to the table if it is new
+        int intern(const string& name){
+            std::lock_guard<std::mutex> guard(lock);
+            std::unordered_map<string,int>::iterator it=ids.find(name);
+            if (it!=ids.end()) return it->second;
+            int id=names.size();
+            names.push_back(name);
+            ids[name]=id;
+            return id;
+        }
+
+        // Returns the id of name, or -1 if it was never interned
+        int find(const string& name) const{
+            std::lock_guard<std::mutex> guard(lock);
+            std::unordered_map<string,int>::const_iterator it=ids.find(name);
+            if (it==ids.end()) return -1;
+            return it->second;
+        }
+
+        const string& name(int id) const{
+            std::lock_guard<std::mutex> guard(lock);
+            return names[id];
+        }
+
+        int count() const{
+            std::lock_guard<std::mutex> guard(lock);
+            return names.size();
+        }
+};
+
+/////////////////////////////////////////////////////////////
+////// Arena
+// Bump allocator for the short-lived data of one operation. Each thread has its own arena,
+// so threads never contend for it. While an ArenaScope is open on a thread, long words and
+// containers using ArenaAllocator take their memory from the arena. Nothing is freed
+// individually; closing the scope releases everything allocated inside it at once.
+// Data that must outlive the scope is copied out under an ArenaPause, which sends
+// allocations back to the heap.
+// Rule: memory is only taken from the arena for data made inside the innermost open scope.
+// A Word remembers the scope it was made in and grows on the heap when that scope is not
+// the innermost open one (or none was open), so a word made before a scope can grow inside
+// it and still outlive it. An ArenaAllocator container uses the arena that was current when
+// it was made, so it must not be made in one scope and grown in a nested one.
+class Arena{
+    private:
+        struct Chunk{
+            char* data;
+            size_t size;
+        };
+        vector<Chunk> chunks;
+        size_t chunk;   // chunk being filled
+        size_t used;    // bytes used in it
+        int depth;      // open scopes
+        unsigned long long scope; // id of the innermost open scope
+        static const size_t CHUNK_SIZE=1<<16;
+        static const size_t KEEP=1<<22; // memory kept for reuse when the last scope closes
+
+        Arena():chunk(0),used(0),depth(0),scope(0){}
+        Arena(const Arena&);
+        Arena& operator=(const Arena&);
+
+        static Arena& local(){
+            static thread_local Arena arena;
+            return arena;
+        }
+
+        static Arena*& active(){
+            static thread_local Arena* arena=0;
+            return arena;
+        }
+
+        // Source of scope ids, unique across threads
+        static unsigned long long nextScope(){
+            static std::atomic<unsigned long long> last(0);
+            return ++last;
+        }
+
+    public:
+        ~Arena(){
+            for (int i=0;i<chunks.size();i++) ::operator delete(chunks[i].data);
+        }
+
+        // The arena of this thread if a scope is open (and not paused), else 0
+        static Arena* current(){
+            return active();
+        }
+
+        // The id of the innermost open scope of this thread, 0 if none is open or it is paused
+        static unsigned long long currentScope(){
+            Arena* arena=active();
+            return arena ? arena->scope : 0;
+        }
+
+        void* allocate(size_t n){
+            n=(n+15)&~(size_t)15;
+            while (chunk<chunks.size() && used+n>chunks[chunk].size){
+                chunk++;
+                used=0;
+            }
+            if (chunk==chunks.size()){
+                Chunk c;
+                c.size=max(n,(size_t)CHUNK_SIZE);
+                c.data=(char*)::operator new(c.size);
+                chunks.push_back(c);
+                used=0;
+            }
+            void* p=chunks[chunk].data+used;
+            used+=n;
+            return p;
+        }
+
+        friend class ArenaScope;
+        friend class ArenaPause;
+};
+
+// Opens the arena of this thread until the end of the enclosing block (no-op if !enabled).
+// Declare it before the containers it is meant to serve, so they are destroyed first.
+// Scopes nest: an inner scope releases only what was allocated since it was opened.
+class ArenaScope{
+    private:
+        bool enabled;
+        size_t chunk, used;
+        unsigned long long outer;
+        Arena* previous;
+        ArenaScope(const ArenaScope&);
+        ArenaScope& operator=(const ArenaScope&);
+    public:
+        ArenaScope(bool enabled=true):enabled(enabled){
+            if (!enabled) return;
+            Arena& arena=Arena::local();
+            chunk=arena.chunk;
+            used=arena.used;
+            arena.depth++;
+            outer=arena.scope;
+            arena.scope=Arena::nextScope();
+            previous=Arena::active();
+            Arena::active()=&arena;
+        }
+
+        ~ArenaScope(){
+            if (!enabled) return;
+            Arena& arena=Arena::local();
+            arena.chunk=chunk;
+            arena.used=used;
+            arena.scope=outer;
+            Arena::active()=previous;
+            if (--arena.depth>0) return;
+            // Keep the first chunk, and more up to KEEP bytes, for the next operation on this thread
+            size_t keep=1, kept=arena.chunks.empty() ? 0 : arena.chunks[0].size;
+            while (keep<arena.chunks.size() && kept+arena.chunks[keep].size<=Arena::KEEP) kept+=arena.chunks[keep++].size;
+            for (size_t k=keep;k<arena.chunks.size();k++) ::operator delete(arena.chunks[k].data);
+            if (keep<arena.chunks.size()) arena.chunks.resize(keep);
+        }
+};
+
+// Sends allocations of this thread to the heap until the end of the enclosing block
+class ArenaPause{
+    private:
+        Arena* previous;
+        ArenaPause(const ArenaPause&);
+        ArenaPause& operator=(const ArenaPause&);
+    public:
+        ArenaPause():previous(Arena::active()){
+            Arena::active()=0;
+        }
+
+        ~ArenaPause(){
+            Arena::active()=previous;
+        }
+};
+
+// Standard allocator that uses the arena open when the container was created, or the heap
+template <class T>
+struct ArenaAllocator{
+    typedef T value_type;
+    Arena* arena;
+
+    ArenaAllocator():arena(Arena::current()){}
+
+    template <class U>
+    ArenaAllocator(const ArenaAllocator<U>& rhs):arena(rhs.arena){}
+
+    T* allocate(size_t n){
+        if (arena) return (T*)arena->allocate(n*sizeof(T));
+        return (T*)::operator new(n*sizeof(T));
+    }
+
+    void deallocate(T* p, size_t){
+        if (!arena) ::operator delete(p);
+    }
+
+    template <class U>
+    bool operator==(const ArenaAllocator<U>& rhs) const{
+        return arena==rhs.arena;
+    }
+
+    template <class U>
+    bool operator!=(const ArenaAllocator<U>& rhs) const{
+        return arena!=rhs.arena;
+    }
+};
+
+/////////////////////////////////////////////////////////////
+////// Words
+// The ordered list of basis ids making up a monomial.
+// Short words live in the inline buffer; only long words allocate, from the arena of the
+// thread if the scope the word was made in is still the innermost open one (see Arena), and
+// from the heap otherwise.
+class Word{
+    private:
+        static const int INLINE_SIZE=6;
+        int *data;
+        int len;
+        int cap;    // capacity, negated if data is in an arena
+        int buf[INLINE_SIZE];
+        unsigned long long scope; // arena scope the word was made in, 0 if none
+
+        int capacity() const{
+            return cap<0 ? -cap : cap;
+        }
+
+        bool onHeap() const{
+            return data!=buf && cap>0;
+        }
+
+        void grow(int n){
+            int ncap=max(n,2*capacity());
+            Arena* arena=scope!=0 && Arena::currentScope()==scope ? Arena::current() : 0;
+            int *ndata=arena ? (int*)arena->allocate(sizeof(int)*ncap) : (int*)::operator new(sizeof(int)*ncap);
+            memcpy(ndata,data,sizeof(int)*len);
+            if (onHeap()) ::operator delete(data);
+            data=ndata;
+            cap=arena ? -ncap : ncap;
+        }
+    public:
+        Word():data(buf),len(0),cap(INLINE_SIZE),scope(Arena::currentScope()){}
+
+        Word(const Word& rhs):data(buf),len(0),cap(INLINE_SIZE),scope(Arena::currentScope()){
+            append(rhs.begin(),rhs.end());
+        }
+
+        // Takes over the heap buffer of a long word; short words and arena words are copied
+        Word(Word&& rhs):data(buf),len(0),cap(INLINE_SIZE),scope(Arena::currentScope()){
+            *this=std::move(rhs);
+        }
+
+        ~Word(){
+            if (onHeap()) ::operator delete(data);
+        }
+
+        Word& operator=(const Word& rhs){
+            if (this==&rhs) return *this;
+            len=0;
+            append(rhs.begin(),rhs.end());
+            return *this;
+        }
+
+        Word& operator=(Word&& rhs){
+            if (this==&rhs) return *this;
+            if (!rhs.onHeap()){
+                len=0;
+                append(rhs.begin(),rhs.end());
+            }
+            else{
+                if (onHeap()) ::operator delete(data);
+                data=rhs.data;
+                cap=rhs.cap;
+                len=rhs.len;
+                rhs.data=rhs.buf;
+                rhs.cap=INLINE_SIZE;
+            }
+            rhs.len=0;
+            return *this;
+        }
+
+        int size() const{
+            return len;
+        }
+
+        bool empty() const{
+            return len==0;
+        }
+
+        int& operator[](int i){
+            return data[i];
+        }
+
+        int operator[](int i) const{
+            return data[i];
+        }
+
+        int* begin(){
+            return data;
+        }
+
+        int* end(){
+            return data+len;
+        }
+
+        const int* begin() const{
+            return data;
+        }
+
+        const int* end() const{
+            return data+len;
+        }
+
+        void reserve(int n){
+            if (n>capacity()) grow(n);
+        }
+
+        void push_back(int id){
+            if (len==capacity()) grow(len+1);
+            data[len++]=id;
+        }
+
+        // Appends the ids in [first,last)
+        void append(const int* first, const int* last){
+            int n=last-first;
+            if (len+n>capacity()) grow(len+n);
+            if (n>0) memcpy(data+len,first,sizeof(int)*n);
+            len+=n;
+        }
+
+        void clear(){
+            len=0;
+        }
+
+        bool operator==(const Word& rhs) const{
+            if (len!=rhs.len) return false;
+            return memcmp(data,rhs.data,sizeof(int)*len)==0;
+        }
+
+        bool operator!=(const Word& rhs) const{
+            return !(*this==rhs);
+        }
+
+        // Lexicographic order on ids
+        bool operator<(const Word& rhs) const{
+            return std::lexicographical_compare(begin(),end(),rhs.begin(),rhs.end());
+        }
+
+        // Order dependent hash (FNV-1a over the ids)
+        size_t hash() const{
+            size_t h=14695981039346656037ULL;
+            for (int i=0;i<len;i++){
+                h^=(size_t)(unsigned int)data[i];
+                h*=1099511628211ULL;
+            }
+            return h;
+        }
+};
+
+struct WordHash{
+    size_t operator()(const Word& w) const{
+        return w.hash();
+    }
+};
+
 /////////////////////////////////////////////////////////////
 ////// Basis Elements
 class BasisE{
       private:
-             int id;
+             int id; // interned symbol id
              string symbol;
       public:
-             friend class LieAlgebra;
+             template <class C> friend class BasicLieAlgebra;
+             template <class C> friend class BasicTerm;
              BasisE(){}
              string toString(){
                     return symbol;
-             }                 
+             }
+             int getId() const{
+                    return id;
+             }
              bool operator<(BasisE& a){
-                  if (symbol<a.toString()) return true;
-                  return false;
+                  return id<a.id;
              }
              bool operator>(BasisE& a){
-                  if (symbol>a.toString()) return true;
-                  return false;
+                  return id>a.id;
              }    
 };
 
@@ -187,99 +700,113 @@ class BasisE{
 ////// Terms
 ////////////////////////////////////////////////////////////////
 
-class Term{
+template <class C>
+class BasicTerm{
     public:
-        vector<BasisE> TList;
-        double coef;
-        friend class LieAlgebra;
+        Word TList; // basis ids, in order
+        C coef;
+        friend class BasicLieAlgebra<C>;
         
-        Term(){
-            coef=0;
+        BasicTerm(){
+            coef=C(0);
         }
         
-        Term(BasisE x){
-            TList.push_back(x);
-            coef=1;
+        BasicTerm(BasisE x){
+            TList.push_back(x.id);
+            coef=C(1);
         }
 
         string toString(){
             string symb;
-            vector<BasisE>::iterator it;
             
-            if (coef==0) return "0";
-            else if (coef==-1) symb="-";
-            else if (coef==1) symb="";
+            if (coef==C(0)) return "0";
+            else if (coef==C(-1)) symb="-";
+            else if (coef==C(1)) symb="";
             else{
                 stringstream sstrm;
                 sstrm<<coef;
                 symb=sstrm.str();
             }
-            for (it=TList.begin();it!=TList.end();it++){
-                symb+=it->toString();
-                symb=symb+"*";
+            const SymbolTable& symbols=SymbolTable::instance();
+            for (int i=0;i<TList.size();i++){
+                if (i>0) symb+="*";
+                symb+=symbols.name(TList[i]);
             }
-            string::iterator sit;
-            sit=symb.end()-1;
-            if (*sit=='*')symb.erase(sit);
+            if (TList.empty() && (coef==C(1) || coef==C(-1))) symb+="1";
             return symb;
         }
         
-        bool setCoef(double i){
+        bool setCoef(C i){
             coef=i;
+            return true;
         }
         
-        double getCoef(){
+        C getCoef(){
             return coef;
         }
          
         // Operators
         
-        Term operator-(){
-            Term temp=*this;
+        BasicTerm operator-() const{
+            BasicTerm temp=*this;
             temp.coef=-coef;
             return temp;
         } 
         
-        Term operator*=(const BasisE& rhs){
-            TList.push_back(rhs);
+        // Compound operators work in place. The binary operators copy *this, unless it is a
+        // temporary, which is then reused for the result.
+        BasicTerm& operator*=(const BasisE& rhs){
+            TList.push_back(rhs.id);
             return *this;
         }
         
-        Term operator*(const BasisE& rhs){
-            Term temp=*this;
+        BasicTerm operator*(const BasisE& rhs) const&{
+            BasicTerm temp=*this;
             temp*=rhs;
             return temp;
         }
+        
+        BasicTerm operator*(const BasisE& rhs) &&{
+            *this*=rhs;
+            return std::move(*this);
+        }
          
-        Term operator*=(const Term& rhs){
-            vector<BasisE>::const_iterator it;
-            for (it=rhs.TList.begin();it!=rhs.TList.end();it++){
-                TList.push_back(*it);
-            }
+        BasicTerm& operator*=(const BasicTerm& rhs){
+            TList.append(rhs.TList.begin(),rhs.TList.end());
             coef=coef*rhs.coef;
             reduce();
             return *this;
         }
         
-        Term operator*(const Term& rhs){
-            Term temp=*this;
+        BasicTerm operator*(const BasicTerm& rhs) const&{
+            BasicTerm temp=*this;
             temp*=rhs;
             return temp;
         }
         
-        Term operator*=(double i){
+        BasicTerm operator*(const BasicTerm& rhs) &&{
+            *this*=rhs;
+            return std::move(*this);
+        }
+        
+        BasicTerm& operator*=(C i){
             coef*=i;
             reduce();
             return *this;
         }
          
-        Term operator*(double i){
-            Term temp=*this;
+        BasicTerm operator*(C i) const&{
+            BasicTerm temp=*this;
             temp*=i;
             return temp;
         }
         
-        bool operator==(Term& rhs){
+        BasicTerm operator*(C i) &&{
+            *this*=i;
+            return std::move(*this);
+        }
+        
+        bool operator==(BasicTerm& rhs){
             if (rhs.coef==coef){
                 if (*this|rhs) return true;
                 return false;
@@ -287,81 +814,163 @@ class Term{
             return false;
         }
          
-        bool operator|(Term& rhs){
-            vector<BasisE>::iterator it1, it2;
+        // True if both terms have the same word (coefficients are ignored)
+        bool operator|(BasicTerm& rhs){
             rhs.reduce();
             reduce();
-            it2=rhs.TList.begin();
-            if (rhs.TList.size()!=TList.size()) return false;
-
-            for (it1=TList.begin();it1!=TList.end();it1++){
-                if ((it2->toString()!=it1->toString()))return false;
-                it2++;
-            }
-            return true;
+            return TList==rhs.TList;
         }
         
 
         bool reduce(){
-            if (coef==0){
-                vector<BasisE>::iterator it;
-                it=TList.begin();
-                while (it!=TList.end()){        
-                    it=TList.erase(it);
-                }
-                return true;
-            }
+            if (coef==C(0)) TList.clear();
             return true;
         }
 
-        Term operator=(const Term& rhs){
-            TList=rhs.TList;
-            coef=rhs.coef;
-            return *this;
-        }
-        
-        // reorders the elements of term according to alphabetical order. The algorithm used is an insertion sort.
+        // reorders the elements of term according to basis id. The algorithm used is an insertion sort.
         void reorder(){
-            // a.compare(b) is negative if a<b
-            for (int i=0;i<TList.size();i++){
-                for (int j=0;j<i;j++){
-                    if (TList[i]<TList[j]){
-                        BasisE temp=TList[i];
-                        for (int k=i;k>j;k--){
-                            TList[k]=TList[k-1];
-                        }
-                        TList[j]=temp;
-                        break;
-                    }
+            for (int i=1;i<TList.size();i++){
+                int cur=TList[i];
+                int k=i;
+                for (;k>0 && cur<TList[k-1];k--){
+                    TList[k]=TList[k-1];
                 }
+                TList[k]=cur;
             }
         }
     
         
-        bool operator<(const Term& other){
+        bool operator<(const BasicTerm& other){
             return TList.size()<other.TList.size();
         }
-        
+};
+
+
+////////////////////////////////////////////////////////////////
+////// Term accumulation
+////////////////////////////////////////////////////////////////
+
+// Combines like terms as they are added. Terms are kept in insertion order;
+// an open addressing (linear probing) table maps each word to its position,
+// so adding a term is amortized O(1) instead of a scan over all terms.
+template <class C>
+class TermAccumulator{
     private:
-        int hash(){
-            vector<BasisE>::iterator it;
-            int sum=0;
-            for (it=TList.begin();it!=TList.end();it++){
-                int k=0,h=0;
-                const char* cur=it->toString().c_str();
-                while (*cur!=0){
-                    h+=*(cur++)<<(k++);
+        typedef BasicTerm<C> Term;
+        struct Slot{
+            int index; // position in terms, -1 if empty
+            unsigned int hash;
+        };
+        vector<Term,ArenaAllocator<Term> > terms;
+        vector<Slot,ArenaAllocator<Slot> > slots;
+        size_t mask;
+
+        void rehash(size_t capacity){
+            Slot empty={-1,0};
+            slots.assign(capacity,empty);
+            mask=capacity-1;
+            for (int i=0;i<terms.size();i++){
+                unsigned int h=terms[i].TList.hash();
+                size_t pos=h&mask;
+                while (slots[pos].index>=0) pos=(pos+1)&mask;
+                slots[pos].index=i;
+                slots[pos].hash=h;
+            }
+        }
+
+    public:
+        TermAccumulator(size_t expected=0){
+            size_t capacity=16;
+            while (capacity<2*expected) capacity*=2;
+            terms.reserve(expected);
+            rehash(capacity);
+        }
+
+        // Adds c to the term with word w if there is one and returns true. Otherwise reserves
+        // a slot for w, which the caller fills by appending a term, and returns false.
+        bool merge(const Word& w, C c){
+            if (2*(terms.size()+1)>slots.size()) rehash(2*slots.size());
+            unsigned int h=w.hash();
+            size_t pos=h&mask;
+            while (slots[pos].index>=0){
+                if (slots[pos].hash==h && terms[slots[pos].index].TList==w){
+                    terms[slots[pos].index].coef+=c;
+                    return true;
                 }
-                sum+=h*h;
+                pos=(pos+1)&mask;
             }
-            return sum;
+            slots[pos].index=terms.size();
+            slots[pos].hash=h;
+            return false;
+        }
+
+        // Adds c*w, merging it into the term with the same word if there is one
+        void add(const Word& w, C c){
+            if (merge(w,c)) return;
+            terms.push_back(Term());
+            terms.back().TList=w;
+            terms.back().coef=c;
+        }
+
+        void add(Word&& w, C c){
+            if (merge(w,c)) return;
+            terms.push_back(Term());
+            terms.back().TList=std::move(w);
+            terms.back().coef=c;
+        }
+
+        void add(const Term& t){
+            add(t.TList,t.coef);
+        }
+
+        void add(Term&& t){
+            if (merge(t.TList,t.coef)) return;
+            terms.push_back(std::move(t));
+        }
+
+        // Adds the product of two terms without building it first
+        void addProduct(const Term& t1, const Term& t2){
+            C c=t1.coef*t2.coef;
+            if (CoefTraits<C>::isZero(c)) return;
+            Word w;
+            w.reserve(t1.TList.size()+t2.TList.size());
+            w.append(t1.TList.begin(),t1.TList.end());
+            w.append(t2.TList.begin(),t2.TList.end());
+            add(std::move(w),c);
+        }
+
+        int size() const{
+            return terms.size();
+        }
+
+        // The largest degree of a term with nonzero coefficient, -1 if there is none
+        int maxDegree() const{
+            int d=-1;
+            for (int i=0;i<terms.size();i++){
+                if (terms[i].TList.size()>d && !CoefTraits<C>::isZero(terms[i].coef)) d=terms[i].TList.size();
+            }
+            return d;
         }
-};
 
+        // Moves the accumulated non-zero terms into out, leaving the accumulator empty
+        void release(vector<Term>& out){
+            out.clear();
+            out.reserve(terms.size());
+            for (int i=0;i<terms.size();i++){
+                if (CoefTraits<C>::isZero(terms[i].coef)) continue;
+                out.push_back(std::move(terms[i]));
+            }
+            terms.clear();
+            rehash(16);
+        }
+};
 
 
-class Expression{
+template <class C>
+class BasicExpression{
     private:
+        typedef BasicTerm<C> Term;
+
         // Convert exp to standard form (a+-b=a-b)
         string toStd(string exp){
             string::iterator it;
@@ -374,61 +983,30 @@ class Expression{
             return exp;
         }
         
-        // Term a*b*c -> 1/6(a*b*c+a*c*b+b*a*c+b*c*a+c*a*b+c*b*a)
-        Expression symmetrize(Term a){
-            // First we sort the elements of a
-            a.reorder();
-            Expression ans;
-            int n=a.TList.size();
-            ans=ans+a;
-            while (1){
-                int k,l;
-                bool to_break=true;
-                for (k=n-2;k>=0;k--){
-                    if (a.TList[k]<a.TList[k+1]){
-                        to_break=false;
-                        break;
-                    }
-                }
-                if (to_break) break;
-                for (l=n-1;l>=0;l--){
-                    if (a.TList[k]<a.TList[l]) break;
-                }
-                BasisE temp=a.TList[k];
-                a.TList[k]=a.TList[l];
-                a.TList[l]=temp;
-                for (int j=0;j<(n-k-1)/2;j++){
-                    int first=k+1+j;
-                    int second=n-1-j;
-                    temp=a.TList[first];
-                    a.TList[first]=a.TList[second];
-                    a.TList[second]=temp;
-                }
-                ans=ans+a;
-            }
-            double inversecoef=(double)ans.TList.size();
-            ans=ans*(1.0/inversecoef);
-            return ans;
-        }
     public:
         vector<Term> TList;
-        friend class LieAlgebra;
-        Expression(){}
+        friend class BasicLieAlgebra<C>;
+        BasicExpression(){}
       
-        Expression(Term x){
-            TList.push_back(x);
+        BasicExpression(Term x){
+            TList.push_back(std::move(x));
         }
-        Expression(BasisE x){
+        BasicExpression(BasisE x){
             TList.push_back(Term(x));
         }
         
-        Term getTerm(int i){
+        const Term& getTerm(int i) const{
             return TList[i];
         }
         
+        // number of terms
+        int size() const{
+            return TList.size();
+        }
+        
         string toString(){
             string symb;
-            vector<Term>::iterator it;
+            typename vector<Term>::iterator it;
             if (TList.empty()) return "0";
             for (it=TList.begin();it!=TList.end();it++){
                 symb=symb+it->toString()+"+";
@@ -439,295 +1017,1640 @@ class Expression{
             return toStd(symb);
         }
         // Operators:
+        // Compound operators work in place and return *this. The binary operators copy *this,
+        // unless it is a temporary, which is then reused for the result, so chains like
+        // x*y-y*x+z only copy when they have to.
         // Addition
-        Expression operator+=(const Expression &rhs){
-            vector<Term>::const_iterator it;
-            for (it=rhs.TList.begin();it!=rhs.TList.end();it++){
-                TList.push_back(*it);
+        BasicExpression& operator+=(const BasicExpression &rhs){
+            TList.insert(TList.end(),rhs.TList.begin(),rhs.TList.end());
+            return *this;
+        }
+        
+        BasicExpression& operator+=(BasicExpression&& rhs){
+            if (TList.empty()) TList.swap(rhs.TList);
+            else{
+                TList.reserve(TList.size()+rhs.TList.size());
+                for (int i=0;i<rhs.TList.size();i++) TList.push_back(std::move(rhs.TList[i]));
             }
             return *this;
         }
         
-        Expression operator+(const Expression& rhs){
-            Expression temp=*this;
+        BasicExpression operator+(const BasicExpression& rhs) const&{
+            BasicExpression temp=*this;
             temp+=rhs;
             return temp;
         }
         
-        Expression operator+=(const Term& rhs){
+        BasicExpression operator+(const BasicExpression& rhs) &&{
+            *this+=rhs;
+            return std::move(*this);
+        }
+        
+        BasicExpression& operator+=(const Term& rhs){
             TList.push_back(rhs);
             return *this;
         }
         
-        Expression operator+(const Term& rhs){
-            Expression temp=*this;
+        BasicExpression operator+(const Term& rhs) const&{
+            BasicExpression temp=*this;
             temp+=rhs;
             return temp;
         }
         
-        // Multiplication
+        BasicExpression operator+(const Term& rhs) &&{
+            *this+=rhs;
+            return std::move(*this);
+        }
         
-        Expression operator*=(const Term& rhs){
-            vector<Term>::iterator it;
-            for (it=TList.begin();it!=TList.end();it++){
-                *it=(*it)*(rhs);
+        // Subtraction
+        BasicExpression& operator-=(const BasicExpression& rhs){
+            TList.reserve(TList.size()+rhs.TList.size());
+            typename vector<Term>::const_iterator it;
+            for (it=rhs.TList.begin();it!=rhs.TList.end();it++){
+                TList.push_back(*it);
+                TList.back().coef=-TList.back().coef;
             }
             return *this;
         }
         
-        Expression operator*(const Term &rhs){
-            Expression temp=*this;
+        BasicExpression& operator-=(const Term& rhs){
+            TList.push_back(rhs);
+            TList.back().coef=-TList.back().coef;
+            return *this;
+        }
+        
+        BasicExpression operator-(const BasicExpression& rhs) const&{
+            BasicExpression temp=*this;
+            temp-=rhs;
+            return temp;
+        }
+        
+        BasicExpression operator-(const BasicExpression& rhs) &&{
+            *this-=rhs;
+            return std::move(*this);
+        }
+        
+        BasicExpression operator-(const Term& rhs) const&{
+            BasicExpression temp=*this;
+            temp-=rhs;
+            return temp;
+        }
+        
+        BasicExpression operator-(const Term& rhs) &&{
+            *this-=rhs;
+            return std::move(*this);
+        }
+        
+        BasicExpression operator-() const&{
+            BasicExpression ans=*this;
+            return -std::move(ans);
+        }
+        
+        BasicExpression operator-() &&{
+            typename vector<Term>::iterator it;
+            for (it=TList.begin();it!=TList.end();it++) it->coef=-it->coef;
+            return std::move(*this);
+        }
+        
+        // Multiplication
+        
+        BasicExpression& operator*=(const Term& rhs){
+            typename vector<Term>::iterator it;
+            for (it=TList.begin();it!=TList.end();it++){
+                *it*=rhs;
+            }
+            return *this;
+        }
+        
+        BasicExpression operator*(const Term &rhs) const&{
+            BasicExpression temp=*this;
             temp*=rhs;
             return temp;
         }
         
-        Expression operator*=(double rhs){
-            vector<Term>::iterator it;
+        BasicExpression operator*(const Term &rhs) &&{
+            *this*=rhs;
+            return std::move(*this);
+        }
+        
+        BasicExpression& operator*=(C rhs){
+            typename vector<Term>::iterator it;
             for (it=TList.begin();it!=TList.end();it++){
-                *it=(*it)*(rhs);
+                *it*=rhs;
             }
             return *this;
         }
         
-        Expression operator*(double rhs){
-            Expression temp=*this;
+        BasicExpression operator*(C rhs) const&{
+            BasicExpression temp=*this;
             temp*=rhs;
             return temp;
         }
         
-        Expression operator*(const Expression& rhs){
-            Expression temp;
-            Term t1,t2;
-            vector<Term>::const_iterator it1, it2;
+        BasicExpression operator*(C rhs) &&{
+            *this*=rhs;
+            return std::move(*this);
+        }
+        
+        // Products of expressions combine like terms as they are formed
+        BasicExpression operator*(const BasicExpression& rhs) const{
+            BasicExpression temp;
+            TermAccumulator<C> acc(TList.size()*rhs.TList.size());
+            typename vector<Term>::const_iterator it1, it2;
             for (it1=TList.begin();it1!=TList.end();it1++){
                 for (it2=rhs.TList.begin();it2!=rhs.TList.end();it2++){
-                    t1=*it1;
-                    t2=*it2;
-                    temp+=t1*t2;
+                    acc.addProduct(*it1,*it2);
                 }
             }
-            temp.eliminate();
+            acc.release(temp.TList);
             return temp;
         }
-
-        Expression operator=(const Expression& rhs){
-            TList=rhs.TList;
+        
+        BasicExpression& operator*=(const BasicExpression& rhs){
+            *this=*this*rhs;
             return *this;
         }
-           
-        Expression operator-(){
-            vector<Term>::iterator it;
-            Expression ans;
+        
+        // Simplification
+        
+        bool isZero() const{
+            return TList.size()==0;
+        }
+        
+        // Combines like terms and drops the ones that vanish. Terms keep the order of their first occurrence.
+        void eliminate(){
+            TermAccumulator<C> acc(TList.size());
+            typename vector<Term>::iterator it;
             for (it=TList.begin();it!=TList.end();it++){
-                ans.TList.push_back(-(*it));
+                if (CoefTraits<C>::isZero(it->coef)) continue;
+                acc.add(*it);
+            }
+            acc.release(TList);
+        }
+        
+        // Symmetrization
+        
+        // Calls emit(term) for every distinct rearrangement of the factors of a, in lexicographic
+        // order. Each term gets the coefficient of a divided by the number of rearrangements, the
+        // multinomial n!/(m_1!...m_k!) for factors occurring m_1,...,m_k times, so that the terms add
+        // up to the symmetrization of a. Repeated factors are never enumerated twice.
+        template <class F>
+        static void forEachArrangement(Term a, F emit){
+            a.reorder();
+            C count(1);
+            for (int i=1,run=1;i<a.TList.size();i++){
+                run=(a.TList[i]==a.TList[i-1]) ? run+1 : 1;
+                count=count*C(i+1)/C(run);
+            }
+            a.coef=a.coef/count;
+            do{
+                emit(a);
+            } while (std::next_permutation(a.TList.begin(),a.TList.end()));
+        }
+        
+        // Term a*b*c -> 1/6(a*b*c+a*c*b+b*a*c+b*c*a+c*a*b+c*b*a), a*a*b -> 1/3(a*a*b+a*b*a+b*a*a)
+        static BasicExpression symmetrize(const Term& a){
+            TermAccumulator<C> acc;
+            forEachArrangement(a,[&](const Term& t){
+                acc.add(t);
+            });
+            BasicExpression ans;
+            acc.release(ans.TList);
+            return ans;
+        }
+        
+        // Streams the terms of the symmetrization to emit, one term of this expression at a time
+        // (terms coming from different terms of the expression are not combined)
+        template <class F>
+        void symmetrize(F emit) const{
+            for (int i=0;i<TList.size();i++) forEachArrangement(TList[i],emit);
+        }
+        
+        BasicExpression symmetrize() const{
+            TermAccumulator<C> acc;
+            symmetrize([&](const Term& t){
+                acc.add(t);
+            });
+            BasicExpression ans;
+            acc.release(ans.TList);
+            return ans;
+        }
+};
+
+const Expression ZERO=Expression();
+
+////////////////////////////////////////////////////////////////
+////// Normal form cache
+////////////////////////////////////////////////////////////////
+
+struct CacheStats{
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long evictions;
+    size_t entries;
+    size_t bytes;
+};
+
+// Least recently used cache mapping a word to the normal form of that word (with coefficient 1).
+// Memory use is estimated per entry and kept below a configurable limit.
+// Words are spread by hash over independent shards, each with its own lock, recency list and an
+// equal share of the limit, so threads normal ordering on the same algebra rarely wait for
+// each other. Recency is kept per shard; a global use counter orders entries across shards.
+template <class C>
+class NormalFormCache{
+    private:
+        typedef BasicTerm<C> Term;
+        typedef BasicExpression<C> Expression;
+        static const int SHARDS=16;
+
+        struct Entry{
+            Word word;
+            Expression nf;
+            size_t bytes;
+            unsigned long long used; // value of clock at the last insert or hit
+        };
+        typedef typename std::list<Entry>::iterator EntryRef;
+        struct Shard{
+            std::list<Entry> entries; // most recently used first
+            std::unordered_map<Word,EntryRef,WordHash> index;
+            CacheStats stats;
+            std::mutex lock;
+        };
+        mutable Shard shards[SHARDS];
+        std::atomic<size_t> limit;
+        std::atomic<unsigned long long> clock;
+
+        static size_t wordBytes(const Word& w){
+            return w.size()>6 ? sizeof(int)*w.size() : 0;
+        }
+
+        static size_t entryBytes(const Word& w, const Expression& nf){
+            size_t bytes=sizeof(Entry)+2*wordBytes(w)+64; // list node, index node and key copy
+            for (int i=0;i<nf.TList.size();i++){
+                bytes+=sizeof(Term)+wordBytes(nf.TList[i].TList);
+            }
+            return bytes;
+        }
+
+        Shard& shardOf(const Word& w){
+            return shards[(w.hash()>>40)%SHARDS];
+        }
+
+        // Evicts from s, whose lock is held, until it fits its share of the limit
+        void evict(Shard& s){
+            size_t share=limit/SHARDS;
+            while (s.stats.bytes>share && !s.entries.empty()){
+                s.stats.bytes-=s.entries.back().bytes;
+                s.index.erase(s.entries.back().word);
+                s.entries.pop_back();
+                s.stats.evictions++;
+            }
+            s.stats.entries=s.entries.size();
+        }
+
+        void init(size_t bytes){
+            limit=bytes;
+            clock=0;
+            for (int k=0;k<SHARDS;k++) memset(&shards[k].stats,0,sizeof(CacheStats));
+        }
+
+    public:
+        NormalFormCache(size_t limit=64<<20){
+            init(limit);
+        }
+
+        // Copies only the limit; the copy starts empty
+        NormalFormCache(const NormalFormCache& rhs){
+            init(rhs.getLimit());
+        }
+
+        NormalFormCache& operator=(const NormalFormCache& rhs){
+            if (this==&rhs) return *this;
+            setLimit(rhs.getLimit());
+            clear();
+            return *this;
+        }
+
+        // Copies the cached normal form of w into nf; returns false on a miss
+        bool lookup(const Word& w, Expression& nf){
+            Shard& s=shardOf(w);
+            std::lock_guard<std::mutex> guard(s.lock);
+            typename std::unordered_map<Word,EntryRef,WordHash>::iterator it=s.index.find(w);
+            if (it==s.index.end()){
+                s.stats.misses++;
+                return false;
+            }
+            s.stats.hits++;
+            s.entries.splice(s.entries.begin(),s.entries,it->second);
+            it->second->used=clock++;
+            nf=it->second->nf;
+            return true;
+        }
+
+        void insert(const Word& w, const Expression& nf){
+            Entry e;
+            e.word=w;
+            e.nf=nf;
+            e.bytes=entryBytes(w,nf);
+            Shard& s=shardOf(w);
+            std::lock_guard<std::mutex> guard(s.lock);
+            if (e.bytes>limit/SHARDS || s.index.count(w)) return;
+            e.used=clock++;
+            s.entries.push_front(std::move(e));
+            s.index[w]=s.entries.begin();
+            s.stats.bytes+=s.entries.front().bytes;
+            evict(s);
+        }
+
+        void clear(){
+            for (int k=0;k<SHARDS;k++){
+                std::lock_guard<std::mutex> guard(shards[k].lock);
+                shards[k].entries.clear();
+                shards[k].index.clear();
+                shards[k].stats.bytes=0;
+                shards[k].stats.entries=0;
+            }
+        }
+
+        // Sets the memory limit in bytes; 0 disables caching
+        void setLimit(size_t bytes){
+            limit=bytes;
+            for (int k=0;k<SHARDS;k++){
+                std::lock_guard<std::mutex> guard(shards[k].lock);
+                evict(shards[k]);
+            }
+        }
+
+        size_t getLimit() const{
+            return limit;
+        }
+
+        // The cached words and their normal forms, least recently used first
+        vector<std::pair<Word,Expression> > snapshot() const{
+            vector<const Entry*> all;
+            vector<std::unique_lock<std::mutex> > guards;
+            for (int k=0;k<SHARDS;k++){
+                Shard& s=shards[k];
+                guards.push_back(std::unique_lock<std::mutex>(s.lock));
+                typename std::list<Entry>::const_iterator it;
+                for (it=s.entries.begin();it!=s.entries.end();it++) all.push_back(&*it);
+            }
+            std::sort(all.begin(),all.end(),[](const Entry* a, const Entry* b){
+                return a->used<b->used;
+            });
+            vector<std::pair<Word,Expression> > out;
+            for (int k=0;k<all.size();k++) out.push_back(std::make_pair(all[k]->word,all[k]->nf));
+            return out;
+        }
+
+        CacheStats getStats() const{
+            CacheStats total;
+            memset(&total,0,sizeof(total));
+            for (int k=0;k<SHARDS;k++){
+                Shard& s=shards[k];
+                std::lock_guard<std::mutex> guard(s.lock);
+                total.hits+=s.stats.hits;
+                total.misses+=s.stats.misses;
+                total.evictions+=s.stats.evictions;
+                total.entries+=s.stats.entries;
+                total.bytes+=s.stats.bytes;
+            }
+            return total;
+        }
+
+        void resetStats(){
+            for (int k=0;k<SHARDS;k++){
+                std::lock_guard<std::mutex> guard(shards[k].lock);
+                shards[k].stats.hits=0;
+                shards[k].stats.misses=0;
+                shards[k].stats.evictions=0;
+            }
+        }
+};
+
+////////////////////////////////////////////////////////////////
+////// PBW monomial index
+////////////////////////////////////////////////////////////////
+
+// Numbers the ordered monomials of degree at most maxDegree in n basis elements, in the order of
+// BasicLieAlgebra::pbwMonomials: by degree, then lexicographically. A monomial is given by the
+// nondecreasing sequence of its basis indices. Ranks are computed in the combinatorial number
+// system for multisets, from the number of nondecreasing sequences of each length with entries
+// in [v,n), without listing the monomials.
+class PbwIndex{
+    private:
+        int n, maxDegree;
+        vector<size_t> offset; // offset[k] = number of monomials of degree < k
+        vector<vector<size_t> > before; // before[L][v] = sequences of length L+1 with first entry < v
+
+    public:
+        PbwIndex(int n, int maxDegree):n(n),maxDegree(maxDegree){
+            // seq[v] = number of nondecreasing sequences of the current length with entries in [v,n)
+            vector<size_t> seq(n+1,1);
+            offset.assign(maxDegree+2,0);
+            before.assign(maxDegree+1,vector<size_t>(n+1,0));
+            for (int L=0;L<=maxDegree;L++){
+                offset[L+1]=offset[L]+seq[0];
+                for (int v=0;v<n;v++) before[L][v+1]=before[L][v]+seq[v];
+                // sequences one longer: a first entry u>=v followed by a sequence in [u,n)
+                vector<size_t> longer(n+1,0);
+                for (int v=n-1;v>=0;v--) longer[v]=longer[v+1]+seq[v];
+                seq.swap(longer);
+            }
+        }
+
+        int degree() const{
+            return maxDegree;
+        }
+
+        // Number of monomials of degree at most maxDegree
+        size_t count() const{
+            return offset[maxDegree+1];
+        }
+
+        // Number of monomials of degree at most d, d<=maxDegree
+        size_t count(int d) const{
+            return offset[d+1];
+        }
+
+        // The index of the monomial with basis indices a[0]<=...<=a[k-1], k<=maxDegree
+        size_t rank(const int* a, int k) const{
+            size_t r=offset[k];
+            int prev=0;
+            for (int p=0;p<k;p++){
+                const vector<size_t>& b=before[k-p-1];
+                r+=b[a[p]]-b[prev];
+                prev=a[p];
+            }
+            return r;
+        }
+
+        // The basis indices of the monomial with index r
+        vector<int> unrank(size_t r) const{
+            int k=0;
+            while (offset[k+1]<=r) k++;
+            r-=offset[k];
+            vector<int> a;
+            int prev=0;
+            for (int p=0;p<k;p++){
+                const vector<size_t>& b=before[k-p-1];
+                int u=prev;
+                while (u+1<n && b[u+1]-b[prev]<=r) u++;
+                r-=b[u]-b[prev];
+                a.push_back(u);
+                prev=u;
+            }
+            return a;
+        }
+};
+
+////////////////////////////////////////////////////////////////
+////// Adjoint matrix cache
+////////////////////////////////////////////////////////////////
+
+// The matrices of ad x_i of all basis elements on the monomials of degree at most d, kept per d
+// (see BasicLieAlgebra::adjointAction). The image of degree d monomials may reach a higher degree
+// rowDegree when brackets are not linear. Entries are shared, so callers keep using an entry after
+// it is evicted by clear(). Copies start empty.
+template <class C>
+class AdjointCache{
+    public:
+        struct Entry{
+            int rowDegree;
+            vector<SparseMatrix<C> > ad;
+        };
+        typedef std::shared_ptr<const Entry> EntryPtr;
+
+    private:
+        std::map<int,EntryPtr> entries;
+        unsigned long long generation; // bumped by clear(), so builds that straddle it are not kept
+        mutable std::mutex lock;
+
+    public:
+        AdjointCache():generation(0){}
+
+        // Copying a cache deliberately gives an empty cache
+        AdjointCache(const AdjointCache&):generation(0){}
+
+        AdjointCache& operator=(const AdjointCache&){
+            clear();
+            return *this;
+        }
+
+        // The entry for degree d, made by build(d,entry) if it is not cached yet. The build runs
+        // without the lock, so callers wanting other degrees are not held up; two threads asking
+        // for the same new degree may both build it, and the first one stored is kept.
+        template <class F>
+        EntryPtr get(int d, F build){
+            unsigned long long started;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                typename std::map<int,EntryPtr>::iterator it=entries.find(d);
+                if (it!=entries.end()) return it->second;
+                started=generation;
+            }
+            std::shared_ptr<Entry> e=std::make_shared<Entry>();
+            build(d,*e);
+            std::lock_guard<std::mutex> guard(lock);
+            if (generation!=started) return e;
+            return entries.insert(std::make_pair(d,EntryPtr(e))).first->second;
+        }
+
+        void clear(){
+            std::lock_guard<std::mutex> guard(lock);
+            entries.clear();
+            generation++;
+        }
+};
+
+////////////////////////////////////////////////////////////////
+////// Truncation
+////////////////////////////////////////////////////////////////
+
+// Which terms of their results the operations of an algebra keep (see BasicLieAlgebra::setTruncation).
+//     maxDegree   terms of higher degree are discarded; -1 keeps every degree
+//     topDegree   only the terms of the highest degree that does not cancel are kept (the symbol)
+struct Truncation{
+    int maxDegree;
+    bool topDegree;
+
+    Truncation(int maxDegree=-1, bool topDegree=false):maxDegree(maxDegree),topDegree(topDegree){}
+
+    bool none() const{
+        return maxDegree<0 && !topDegree;
+    }
+
+    bool keeps(int degree) const{
+        return maxDegree<0 || degree<=maxDegree;
+    }
+};
+
+////////////////////////////////////////////////////////////////
+////// Engine statistics
+////////////////////////////////////////////////////////////////
+
+// Work done by a Lie algebra since statistics were enabled or last reset (see BasicLieAlgebra::stats)
+struct EngineStats{
+    unsigned long long normalOrders;    // calls to normalOrder (and Simplify)
+    unsigned long long flips;           // calls to flip
+    unsigned long long flipwcs;         // calls to flipwc (including those made by flip)
+    unsigned long long rewriteSteps;    // adjacent swaps b*a -> a*b-[a,b] made while normal ordering
+    unsigned long long sideTerms;       // terms of [a,b] put on the worklist by those swaps
+    size_t peakTerms;                   // most terms held by one normal ordering (worklist and result)
+    size_t peakWorklist;                // most words waiting in one normal ordering worklist
+    double parseSeconds;                // time in fromString
+    double multiplySeconds;             // time multiplying expressions in commutator and flipwc
+    double normalOrderSeconds;          // time in normalOrder, which also combines like terms
+};
+
+// Thread safe accumulators behind EngineStats. Nothing is recorded unless enabled.
+class EngineCounters{
+    private:
+        std::atomic<bool> on;
+        std::atomic<unsigned long long> normalOrders, flips, flipwcs, rewriteSteps, sideTerms;
+        std::atomic<size_t> peakTerms, peakWorklist;
+        std::atomic<unsigned long long> parseNanos, multiplyNanos, normalOrderNanos;
+
+        static void raise(std::atomic<size_t>& peak, size_t value){
+            size_t old=peak.load();
+            while (value>old && !peak.compare_exchange_weak(old,value)){}
+        }
+
+    public:
+        EngineCounters():on(false){
+            reset();
+        }
+
+        // Copies only whether counting is enabled; the copy starts from zero
+        EngineCounters(const EngineCounters& rhs):on(rhs.enabled()){
+            reset();
+        }
+
+        EngineCounters& operator=(const EngineCounters& rhs){
+            on=rhs.enabled();
+            reset();
+            return *this;
+        }
+
+        bool enabled() const{
+            return on.load(std::memory_order_relaxed);
+        }
+
+        void enable(bool e){
+            on=e;
+        }
+
+        void reset(){
+            normalOrders=0;
+            flips=0;
+            flipwcs=0;
+            rewriteSteps=0;
+            sideTerms=0;
+            peakTerms=0;
+            peakWorklist=0;
+            parseNanos=0;
+            multiplyNanos=0;
+            normalOrderNanos=0;
+        }
+
+        void countNormalOrder(){
+            if (enabled()) normalOrders++;
+        }
+
+        void countFlip(){
+            if (enabled()) flips++;
+        }
+
+        void countFlipwc(){
+            if (enabled()) flipwcs++;
+        }
+
+        // Totals of one run of the normal ordering worklist
+        void countRewrite(unsigned long long steps, unsigned long long side, size_t terms, size_t worklist){
+            if (!enabled()) return;
+            rewriteSteps+=steps;
+            sideTerms+=side;
+            raise(peakTerms,terms);
+            raise(peakWorklist,worklist);
+        }
+
+        enum Phase{PARSE, MULTIPLY, NORMAL_ORDER};
+
+        // Adds the lifetime of a Timer to one of the phase totals
+        class Timer{
+            private:
+                std::atomic<unsigned long long>* total;
+                std::chrono::steady_clock::time_point start;
+            public:
+                Timer(EngineCounters& counters, Phase phase):total(0){
+                    if (!counters.enabled()) return;
+                    if (phase==PARSE) total=&counters.parseNanos;
+                    else if (phase==MULTIPLY) total=&counters.multiplyNanos;
+                    else total=&counters.normalOrderNanos;
+                    start=std::chrono::steady_clock::now();
+                }
+                ~Timer(){
+                    if (!total) return;
+                    *total+=std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-start).count();
+                }
+        };
+
+        EngineStats get() const{
+            EngineStats s;
+            s.normalOrders=normalOrders;
+            s.flips=flips;
+            s.flipwcs=flipwcs;
+            s.rewriteSteps=rewriteSteps;
+            s.sideTerms=sideTerms;
+            s.peakTerms=peakTerms;
+            s.peakWorklist=peakWorklist;
+            s.parseSeconds=parseNanos*1e-9;
+            s.multiplySeconds=multiplyNanos*1e-9;
+            s.normalOrderSeconds=normalOrderNanos*1e-9;
+            return s;
+        }
+};
+          
+////////////////////////////////////////////////////////////////
+////// Structure constants
+////////////////////////////////////////////////////////////////
+
+// The nonzero brackets [x_i,x_j], i<j, of an algebra. Entries are kept per row i, sorted by
+// column j, so a lookup is a binary search in one row and a row can be walked directly.
+// Memory is proportional to the number of nonzero brackets.
+template <class C>
+class StructureConstants{
+    private:
+        typedef BasicExpression<C> Expression;
+    public:
+        struct Entry{
+            int col;
+            Expression value;
+        };
+    private:
+        vector<vector<Entry> > rows;
+        size_t nonzero;
+
+        static bool colLess(const Entry& e, int col){
+            return e.col<col;
+        }
+
+    public:
+        StructureConstants():nonzero(0){}
+
+        // Clears all brackets and sets the number of basis elements
+        void resize(int n){
+            rows.assign(n,vector<Entry>());
+            nonzero=0;
+        }
+
+        // [x_i,x_j] for i<j; a shared zero expression if the bracket vanishes
+        const Expression& get(int i, int j) const{
+            static const Expression zero;
+            const vector<Entry>& row=rows[i];
+            typename vector<Entry>::const_iterator it=std::lower_bound(row.begin(),row.end(),j,colLess);
+            if (it==row.end() || it->col!=j) return zero;
+            return it->value;
+        }
+
+        // Sets [x_i,x_j] for i<j; zero values are not stored
+        void set(int i, int j, const Expression& e){
+            vector<Entry>& row=rows[i];
+            typename vector<Entry>::iterator it=std::lower_bound(row.begin(),row.end(),j,colLess);
+            bool present=(it!=row.end() && it->col==j);
+            if (e.TList.empty()){
+                if (present){
+                    row.erase(it);
+                    nonzero--;
+                }
+                return;
+            }
+            if (present){
+                it->value=e;
+                return;
+            }
+            Entry entry;
+            entry.col=j;
+            entry.value=e;
+            row.insert(it,entry);
+            nonzero++;
+        }
+
+        // The nonzero brackets [x_i,x_j], j>i, in increasing j
+        const vector<Entry>& row(int i) const{
+            return rows[i];
+        }
+
+        int dimension() const{
+            return rows.size();
+        }
+
+        // Number of nonzero brackets
+        size_t count() const{
+            return nonzero;
+        }
+};
+
+// The brackets that are linear in the basis, [x_i,x_j] = sum over k of c_ij^k x_k, as a dense
+// tensor indexed (i*n+j)*n+k, so the coefficients of one bracket are contiguous and the
+// contractions below are loops over whole rows. Both [x_i,x_j] and [x_j,x_i] are stored.
+// Brackets that are not linear (e.g. [v1,v2]=0.5h*h+e*f+f*e) are marked and hold zeros.
+template <class C>
+class LinearStructureConstants{
+    private:
+        int n;
+        vector<C> c;
+        vector<char> linear; // n*n, whether [x_i,x_j] is linear
+        int nonlinear; // number of pairs i<j whose bracket is not linear
+
+    public:
+        LinearStructureConstants():n(0),nonlinear(0){}
+
+        // Zero brackets on n basis elements, all linear
+        void resize(int dim){
+            n=dim;
+            c.assign((size_t)n*n*n,C(0));
+            linear.assign((size_t)n*n,1);
+            nonlinear=0;
+        }
+
+        int dimension() const{
+            return n;
+        }
+
+        // Whether all brackets are linear
+        bool allLinear() const{
+            return nonlinear==0;
+        }
+
+        bool isLinear(int i, int j) const{
+            return linear[i*n+j];
+        }
+
+        // Adds a to c_ij^k and subtracts it from c_ji^k
+        void add(int i, int j, int k, C a){
+            c[((size_t)i*n+j)*n+k]+=a;
+            c[((size_t)j*n+i)*n+k]-=a;
+        }
+
+        void setNonlinear(int i, int j){
+            if (!linear[i*n+j]) return;
+            for (int k=0;k<n;k++){
+                c[((size_t)i*n+j)*n+k]=C(0);
+                c[((size_t)j*n+i)*n+k]=C(0);
+            }
+            linear[i*n+j]=linear[j*n+i]=0;
+            nonlinear++;
+        }
+
+        // The coefficients c_ij^0, ..., c_ij^(n-1)
+        const C* bracket(int i, int j) const{
+            return &c[((size_t)i*n+j)*n];
+        }
+
+        // Whether [[x_i,x_j],x_k] only involves linear brackets
+        bool linearOuter(int i, int j, int k) const{
+            if (!linear[i*n+j]) return false;
+            const C* b=bracket(i,j);
+            for (int l=0;l<n;l++){
+                if (!CoefTraits<C>::isZero(b[l]) && !linear[l*n+k]) return false;
+            }
+            return true;
+        }
+
+        // out[m] = coefficient of x_m in [[x_i,x_j],x_k]+[[x_j,x_k],x_i]+[[x_k,x_i],x_j], for a
+        // triple where linearOuter holds for all three terms
+        void jacobi(int i, int j, int k, C* out) const{
+            for (int m=0;m<n;m++) out[m]=C(0);
+            const int triple[3][3]={{i,j,k},{j,k,i},{k,i,j}};
+            for (int t=0;t<3;t++){
+                const C* b=bracket(triple[t][0],triple[t][1]);
+                for (int l=0;l<n;l++){
+                    if (CoefTraits<C>::isZero(b[l])) continue;
+                    const C* r=bracket(l,triple[t][2]);
+                    C a=b[l];
+                    for (int m=0;m<n;m++) out[m]+=a*r[m];
+                }
+            }
+        }
+
+        // (ad x_i) as an n*n matrix, row-major: entry (k,j) is c_ij^k, the coefficient of x_k in [x_i,x_j]
+        vector<C> adjoint(int i) const{
+            vector<C> a((size_t)n*n);
+            for (int j=0;j<n;j++){
+                const C* b=bracket(i,j);
+                for (int k=0;k<n;k++) a[(size_t)k*n+j]=b[k];
+            }
+            return a;
+        }
+
+        // The Killing form K_ij = tr(ad x_i ad x_j) = -sum over k,l of c_ik^l c_lj^k, row-major.
+        // Rows i are computed by threads workers (0 for one per core); row i only visits the
+        // nonzero c_ik^l, and takes them by l so that the reads of c_lj^k for all j stay within the
+        // n*n block of the tensor that belongs to l.
+        vector<C> killing(int threads=0) const{
+            vector<C> K((size_t)n*n,C(0));
+            parallelFor(n,threads,[&](size_t i){
+                C* row=&K[i*n];
+                for (int l=0;l<n;l++){
+                    const C* block=&c[(size_t)l*n*n];
+                    for (int k=0;k<n;k++){
+                        const C& a=c[(i*n+k)*n+l];
+                        if (CoefTraits<C>::isZero(a)) continue;
+                        for (int j=0;j<=(int)i;j++) row[j]-=a*block[(size_t)j*n+k];
+                    }
+                }
+            });
+            for (int i=0;i<n;i++){
+                for (int j=0;j<i;j++) K[(size_t)j*n+i]=K[(size_t)i*n+j];
+            }
+            return K;
+        }
+};
+
+// A triple of basis elements for which the Jacobi identity fails, with the (nonzero) value of
+// [[x_i,x_j],x_k]+[[x_j,x_k],x_i]+[[x_k,x_i],x_j] in normal form.
+template <class C>
+struct JacobiFailure{
+    int i, j, k;
+    BasicExpression<C> residue;
+};
+
+// The commutators of a candidate element z with every basis element: residues[i]=[z,x_i]
+// in normal form. z is central exactly when all residues are zero.
+template <class C>
+struct CentralityReport{
+    BasicExpression<C> element;
+    vector<BasicExpression<C> > residues;
+    bool central;
+};
+
+// Leading bytes and version of binary algebra files (see BasicLieAlgebra::save)
+const char BINARY_MAGIC[8]={'L','I','E','A','L','G','B',0};
+const uint32_t BINARY_VERSION=1;
+
+template <class C>
+class BasicLieAlgebra{
+    private:
+        typedef BasicTerm<C> Term;
+        typedef BasicExpression<C> Expression;
+        typedef BasicPolynomial<C> Polynomial;
+
+        BasisE *basis;
+        string *names;
+        StructureConstants<C> brackets; // nonzero [x_i,x_j] for i<j
+        LinearStructureConstants<C> linearBrackets; // the linear brackets as a dense tensor
+        int bracketDegree; // largest degree of a term of a bracket
+        Truncation truncation; // applied to the results of the public operations (see setTruncation)
+        int size;
+        vector<int> rank; // symbol id -> index of basis element, -1 if not in this algebra
+        NormalFormCache<C> nfCache; // normal forms of words seen by normalOrder
+        AdjointCache<C> adCache; // ad x_i on the monomials up to each degree (see adjointAction)
+        EngineCounters counters;
+        bool arenaEnabled; // whether normal ordering works in the thread's arena (see Arena)
+        
+        // Records the symbol ids of the basis in rank
+        void indexBasis(){
+            rank.assign(SymbolTable::instance().count(),-1);
+            for (int i=0;i<size;i++){
+                rank[(basis+i)->id]=i;
+            }
+        }
+        
+        int rankOf(int id){
+            if (id<0 || id>=rank.size() || rank[id]<0) throw NoSuchBasis();
+            return rank[id];
+        }
+        
+        const Expression& getR(int i,int j){// Gets commutator of basis, i<j
+            return brackets.get(i,j);
+        }
+        
+        bool setR(Expression e, int i, int j){// Sets commutator of basis
+            brackets.set(i,j,e);
+            nfCache.clear();
+            adCache.clear();
+            return true;
+        }
+        
+        // Fills linearBrackets and bracketDegree from brackets; called once the algebra is loaded
+        void indexLinear(){
+            linearBrackets.resize(size);
+            bracketDegree=0;
+            for (int i=0;i<size;i++){
+                const vector<typename StructureConstants<C>::Entry>& row=brackets.row(i);
+                for (int e=0;e<row.size();e++){
+                    int j=row[e].col;
+                    const vector<Term>& terms=row[e].value.TList;
+                    bool linear=true;
+                    for (int t=0;t<terms.size();t++){
+                        if (terms[t].TList.size()!=1) linear=false;
+                        bracketDegree=max(bracketDegree,terms[t].TList.size());
+                    }
+                    if (!linear){
+                        linearBrackets.setNonlinear(i,j);
+                        continue;
+                    }
+                    for (int t=0;t<terms.size();t++){
+                        linearBrackets.add(i,j,rankOf(terms[t].TList[0]),terms[t].coef);
+                    }
+                }
+            }
+        }
+        
+        // Worklist key for normalOrder: longer words first, then words with more inversions
+        struct PendingWord{
+            int degree;
+            int inversions;
+            Word word;
+            bool operator<(const PendingWord& rhs) const{
+                if (degree!=rhs.degree) return degree>rhs.degree;
+                if (inversions!=rhs.inversions) return inversions>rhs.inversions;
+                return word<rhs.word;
+            }
+        };
+        typedef std::map<PendingWord,C,std::less<PendingWord>,ArenaAllocator<std::pair<const PendingWord,C> > > PendingMap;
+        
+        bool isOrdered(const Word& w){
+            for (int i=1;i<w.size();i++){
+                if (rankOf(w[i-1])>rankOf(w[i])) return false;
+            }
+            return true;
+        }
+        
+        // Removes the terms of a that t does not keep; a is sorted by decreasing degree
+        static void truncate(Expression& a, const Truncation& t){
+            if (t.none()) return;
+            int k=0;
+            for (int i=0;i<a.TList.size();i++){
+                if (t.keeps(a.TList[i].TList.size())) a.TList[k++]=std::move(a.TList[i]);
+            }
+            a.TList.resize(k);
+            if (!t.topDegree) return;
+            k=0;
+            while (k<a.TList.size() && a.TList[k].TList.size()==a.TList[0].TList.size()) k++;
+            a.TList.resize(k);
+        }
+        
+        // Runs the normal ordering worklist, adding the normal form of the pending words to result.
+        // Pending words are merged when equal, and the longest, most disordered word is always
+        // taken first. A word is only produced by rewriting words above it in that order,
+        // so each distinct word is normally sorted once. Words found in the cache are not rewritten.
+        // Ordered words that trunc discards by degree are dropped as soon as they appear. In
+        // topDegree mode, when no bracket has terms of degree above 2 (so rewriting never raises the
+        // degree), the worklist is abandoned once the result has a nonzero term of higher degree
+        // than every pending word; the caller drops the lower terms of result.
+        void expand(PendingMap& pending, TermAccumulator<C>& result, const Truncation& trunc=Truncation()){
+            Word prefix;
+            Expression nf;
+            unsigned long long steps=0, side=0;
+            size_t peakTerms=0, peakWorklist=0;
+            int level=-1; // degree of the last word taken in topDegree mode
+            while (!pending.empty()){
+                if (pending.size()>peakWorklist) peakWorklist=pending.size();
+                if (pending.size()+result.size()>peakTerms) peakTerms=pending.size()+result.size();
+                typename PendingMap::iterator top=pending.begin();
+                if (trunc.topDegree && bracketDegree<=2 && top->first.degree!=level){
+                    level=top->first.degree;
+                    if (result.maxDegree()>level) break;
+                }
+                Word w=top->first.word;
+                C c=top->second;
+                pending.erase(top);
+                if (CoefTraits<C>::isZero(c)) continue;
+                if (w.size()>2 && nfCache.getLimit()>0 && !isOrdered(w) && nfCache.lookup(w,nf)){
+                    for (int i=0;i<nf.TList.size();i++){
+                        if (!trunc.keeps(nf.TList[i].TList.size())) continue;
+                        result.add(nf.TList[i].TList,c*nf.TList[i].coef);
+                    }
+                    continue;
+                }
+
+                // Insertion sort; every adjacent swap b*a=a*b-[a,b] leaves a side term behind
+                for (int i=1;i<w.size();i++){
+                    for (int j=i;j>0 && rankOf(w[j-1])>rankOf(w[j]);j--){
+                        const Expression& br=getR(rankOf(w[j]),rankOf(w[j-1]));
+                        typename vector<Term>::const_iterator bt;
+                        for (bt=br.TList.begin();bt!=br.TList.end();bt++){
+                            prefix.clear();
+                            prefix.append(w.begin(),w.begin()+j-1);
+                            prefix.append(bt->TList.begin(),bt->TList.end());
+                            prefix.append(w.begin()+j+1,w.end());
+                            addPending(pending,prefix,-c*bt->coef);
+                        }
+                        side+=br.TList.size();
+                        steps++;
+                        int temp=w[j];
+                        w[j]=w[j-1];
+                        w[j-1]=temp;
+                    }
+                }
+                if (trunc.keeps(w.size())) result.add(w,c);
+            }
+            pending.clear();
+            counters.countRewrite(steps,side,peakTerms,peakWorklist);
+        }
+        
+        void addPending(PendingMap& pending, const Word& w, C c){
+            PendingWord key;
+            key.degree=w.size();
+            key.inversions=0;
+            for (int i=0;i<w.size();i++){
+                for (int j=i+1;j<w.size();j++){
+                    if (rankOf(w[i])>rankOf(w[j])) key.inversions++;
+                }
+            }
+            key.word=w;
+            pending[key]+=c;
+        }
+        
+        // Adds c*[u,g] for the word u and the basis element (symbol id) g, by the Leibniz rule
+        void addLeibniz(TermAccumulator<C>& acc, const Word& u, int g, C c){
+            Word w;
+            int rg=rankOf(g);
+            typename vector<Term>::const_iterator bt;
+            for (int i=0;i<u.size();i++){
+                int ri=rankOf(u[i]);
+                if (ri==rg) continue;
+                const Expression& br=ri<rg ? getR(ri,rg) : getR(rg,ri);
+                C sign=ri<rg ? c : -c;
+                for (bt=br.TList.begin();bt!=br.TList.end();bt++){
+                    w.clear();
+                    w.append(u.begin(),u.begin()+i);
+                    w.append(bt->TList.begin(),bt->TList.end());
+                    w.append(u.begin()+i+1,u.end());
+                    acc.add(w,sign*bt->coef);
+                }
+            }
+        }
+        
+        // Basis indices of an ordered word
+        vector<int> ranksOf(const Word& w){
+            vector<int> a(w.size());
+            for (int k=0;k<w.size();k++) a[k]=rankOf(w[k]);
+            return a;
+        }
+        
+        // Computes the matrices of ad x_i on the monomials of degree at most d (see adjointAction)
+        void buildAdjoint(int d, typename AdjointCache<C>::Entry& entry, int threads){
+            vector<Word> monomials=pbwMonomials(d);
+            size_t n=monomials.size();
+            vector<Expression> images(n*size);
+            parallelFor(n*size,threads,[&](size_t t){
+                Expression m;
+                m.TList.push_back(Term());
+                m.TList[0].TList=monomials[t%n];
+                m.TList[0].coef=C(1);
+                images[t]=commutator(Expression(*(basis+t/n)),std::move(m),Truncation());
+            });
+            entry.rowDegree=d;
+            for (size_t t=0;t<images.size();t++) entry.rowDegree=max(entry.rowDegree,degreeOf(images[t]));
+            PbwIndex rows(size,entry.rowDegree);
+            entry.ad.resize(size);
+            for (int i=0;i<size;i++){
+                vector<vector<std::pair<int,C> > > columns(n);
+                for (size_t m=0;m<n;m++){
+                    const Expression& image=images[i*n+m];
+                    for (int k=0;k<image.TList.size();k++){
+                        vector<int> a=ranksOf(image.TList[k].TList);
+                        columns[m].push_back(std::make_pair((int)rows.rank(a.data(),a.size()),image.TList[k].coef));
+                    }
+                }
+                entry.ad[i]=SparseMatrix<C>(rows.count(),columns);
+            }
+        }
+        
+        // The coefficients of the normal form nf on the monomials of index (see PbwIndex)
+        vector<C> coordinatesOf(const Expression& nf, const PbwIndex& index){
+            vector<C> v(index.count(),C(0));
+            for (int k=0;k<nf.TList.size();k++){
+                if (nf.TList[k].TList.size()>index.degree()) throw InvalidExpression();
+                vector<int> a=ranksOf(nf.TList[k].TList);
+                v[index.rank(a.data(),a.size())]+=nf.TList[k].coef;
+            }
+            return v;
+        }
+        
+        // Estimated number of terms and degree of a normal form, for planning products.
+        // A normal form of degree d has at most as many terms as there are ordered monomials of
+        // degree at most d, C(d+n,n) for n basis elements.
+        struct ProductEstimate{
+            double terms;
+            int degree;
+        };
+        
+        ProductEstimate estimate(double terms, int degree){
+            double monomials=1;
+            for (int i=1;i<=size && monomials<terms;i++) monomials=monomials*(degree+i)/i;
+            ProductEstimate e={min(terms,monomials),degree};
+            return e;
+        }
+        
+        ProductEstimate estimateProduct(const ProductEstimate& a, const ProductEstimate& b){
+            return estimate(a.terms*b.terms,a.degree+b.degree);
+        }
+        
+        // Estimated work of normal ordering a*b: every pair of words, each with up to
+        // deg a * deg b inversions
+        static double productCost(const ProductEstimate& a, const ProductEstimate& b){
+            return a.terms*b.terms*(1+(double)a.degree*b.degree);
+        }
+        
+        static int degreeOf(const Expression& a){
+            int d=0;
+            for (int i=0;i<a.TList.size();i++) d=max(d,a.TList[i].TList.size());
+            return d;
+        }
+        
+        // The truncation that can be applied to the partial results of power and product without
+        // changing the final result: the top-degree part when brackets lower the degree
+        Truncation stepTruncation(){
+            if (truncation.topDegree && truncation.maxDegree<0 && bracketDegree<=1) return truncation;
+            return Truncation();
+        }
+        
+        // a*b in normal form, for normal forms a and b. The products are one-off words, so they are
+        // not cached.
+        Expression multiply(const Expression& a, const Expression& b, const Truncation& trunc){
+            Expression ab;
+            {
+                EngineCounters::Timer timer(counters,EngineCounters::MULTIPLY);
+                ab=a*b;
+            }
+            return normalOrder(std::move(ab),false,trunc);
+        }
+        
+        // The product of the normal forms f[i..j] in the order given by split (see product)
+        Expression productRange(const vector<Expression>& f, const vector<vector<int> >& split, int i, int j, const Truncation& trunc){
+            if (i==j) return f[i];
+            int k=split[i][j];
+            return multiply(productRange(f,split,i,k,trunc),productRange(f,split,k+1,j,trunc),trunc);
+        }
+        
+        // Orders symbol ids by the index of their basis element
+        struct RankLess{
+            BasicLieAlgebra* g;
+            RankLess(BasicLieAlgebra* g):g(g){}
+            bool operator()(int id1, int id2) const{
+                return g->rankOf(id1)<g->rankOf(id2);
+            }
+        };
+        
+        // Normal form of the symmetrization of the multiset of factors m (sorted by RankLess),
+        // see symmetrize(Expression). Recursion depth is the size of m.
+        const Expression& symmetrizedNormalForm(const Word& m, std::unordered_map<Word,Expression,WordHash>& memo){
+            typename std::unordered_map<Word,Expression,WordHash>::iterator it=memo.find(m);
+            if (it!=memo.end()) return it->second;
+            Expression sum;
+            if (m.size()<=1){
+                Term t;
+                t.TList=m;
+                t.coef=C(1);
+                sum.TList.push_back(t);
+            }
+            else{
+                Word rest;
+                for (int i=0;i<m.size();i++){
+                    if (i>0 && m[i]==m[i-1]) continue;
+                    int count=1;
+                    while (i+count<m.size() && m[i+count]==m[i]) count++;
+                    rest.clear();
+                    rest.append(m.begin(),m.begin()+i);
+                    rest.append(m.begin()+i+1,m.end());
+                    const Expression& sub=symmetrizedNormalForm(rest,memo);
+                    C weight=C(count)/C((int)m.size());
+                    for (int k=0;k<sub.TList.size();k++){
+                        Term t;
+                        t.TList.push_back(m[i]);
+                        t.TList.append(sub.TList[k].TList.begin(),sub.TList[k].TList.end());
+                        t.coef=weight*sub.TList[k].coef;
+                        sum.TList.push_back(t);
+                    }
+                }
+                sum=normalOrder(sum);
+            }
+            Expression& slot=memo[m];
+            slot=sum;
+            return slot;
+        }
+        
+        // Canonical order of normal ordered terms: higher degree first, then by basis index
+        struct NormalOrderLess{
+            BasicLieAlgebra* g;
+            NormalOrderLess(BasicLieAlgebra* g):g(g){}
+            bool operator()(const Term& t1, const Term& t2) const{
+                if (t1.TList.size()!=t2.TList.size()) return t1.TList.size()>t2.TList.size();
+                for (int i=0;i<t1.TList.size();i++){
+                    int r1=g->rankOf(t1.TList[i]);
+                    int r2=g->rankOf(t2.TList[i]);
+                    if (r1!=r2) return r1<r2;
+                }
+                return false;
+            }
+        };
+        
+        // Parses an algebra description:
+        //     number of basis elements n
+        //     n lines with the names of the basis elements
+        //     any number of relations [a,b]=expression
+        // Blank lines are ignored, lines may end in \n or \r\n and may be of any length.
+        // Errors are reported as FormatError with the line and column they occur at.
+        void load(const string& data){
+            size_t pos=0;
+            int lineNo=0;
+            string line;
+            bool haveSize=false;
+            int named=0;
+            std::unordered_set<int> seen; // symbol ids of the names read so far
+            while (nextLine(data,pos,line)){
+                lineNo++;
+                size_t p=0;
+                skipSpaces(line,p);
+                if (p==line.size()) continue;
+                if (!haveSize){
+                    size_t q=p;
+                    while (q<line.size() && isDigit(line[q])) q++;
+                    size_t end=q;
+                    skipSpaces(line,end);
+                    if (q==p || end!=line.size()) throw FormatError(lineNo,p+1,"expected the number of basis elements");
+                    size=atoi(line.c_str()+p);
+                    basis=new BasisE[size];
+                    names=new string[size];
+                    brackets.resize(size);
+                    haveSize=true;
+                    continue;
+                }
+                if (named<size){
+                    size_t end=line.size();
+                    while (end>p && (line[end-1]==' ' || line[end-1]=='\t')) end--;
+                    string name=line.substr(p,end-p);
+                    int id=SymbolTable::instance().intern(name);
+                    if (!seen.insert(id).second) throw FormatError(lineNo,p+1,"duplicate basis element '"+name+"'");
+                    *(names+named)=name;
+                    (basis+named)->id=id;
+                    (basis+named)->symbol=name;
+                    named++;
+                    if (named==size) indexBasis();
+                    continue;
+                }
+                loadRelation(line,p,lineNo);
+            }
+            if (!haveSize) throw FormatError(lineNo+1,1,"missing number of basis elements");
+            if (named<size) throw FormatError(lineNo+1,1,"missing basis element names");
+            if (size==0) indexBasis();
+        }
+        
+        // Reads the relation [a,b]=expression starting at column p of line
+        void loadRelation(const string& line, size_t p, int lineNo){
+            if (line[p]!='[') throw FormatError(lineNo,p+1,"expected '['");
+            p++;
+            int i1=relationArgument(line,p,',',lineNo);
+            p++;
+            int i2=relationArgument(line,p,']',lineNo);
+            p++;
+            skipSpaces(line,p);
+            if (p>=line.size() || line[p]!='=') throw FormatError(lineNo,p+1,"expected '='");
+            p++;
+            Expression value;
+            try{
+                value=fromString(line.substr(p));
+            }
+            catch(InvalidExpression& e){
+                throw FormatError(lineNo,p+e.column,e.reason);
             }
-            return ans;
+            if (i1>i2) setR(-value,i2,i1);
+            else if (i1<i2) setR(value,i1,i2);
         }
         
-        Expression operator-(Expression rhs){
-            return *this+(-rhs);
+        // Reads a basis element name ending in delim, leaving p at delim, and returns its index
+        int relationArgument(const string& line, size_t& p, char delim, int lineNo){
+            skipSpaces(line,p);
+            size_t start=p;
+            while (p<line.size() && line[p]!=delim && line[p]!=' ' && line[p]!='\t') p++;
+            string name=line.substr(start,p-start);
+            skipSpaces(line,p);
+            if (p>=line.size() || line[p]!=delim) throw FormatError(lineNo,p+1,string("expected '")+delim+"'");
+            if (name.empty()) throw FormatError(lineNo,start+1,"missing basis element");
+            int id=SymbolTable::instance().find(name);
+            if (id<0 || id>=rank.size() || rank[id]<0) throw FormatError(lineNo,start+1,"unknown basis element '"+name+"'");
+            return rank[id];
         }
         
-        Expression operator-(Term rhs){
-            return *this+(-rhs);
+        static bool nextLine(const string& data, size_t& pos, string& line){
+            if (pos>=data.size()) return false;
+            size_t end=data.find('\n',pos);
+            if (end==string::npos) end=data.size();
+            size_t stop=end;
+            if (stop>pos && data[stop-1]=='\r') stop--;
+            line.assign(data,pos,stop-pos);
+            pos=end+1;
+            return true;
         }
         
-        // Simplification
+        static void skipSpaces(const string& line, size_t& p){
+            while (p<line.size() && (line[p]==' ' || line[p]=='\t')) p++;
+        }
         
-        bool isZero(){
-            if (TList.size()==0) return true;
+        void writeWord(string& out, const Word& w){
+            uint32_t n=w.size();
+            putBytes(out,&n,sizeof(n));
+            for (int i=0;i<w.size();i++){
+                uint32_t r=rankOf(w[i]);
+                putBytes(out,&r,sizeof(r));
+            }
         }
         
-        void eliminate(){
-            vector<Term>::iterator it1,it2;
-            for (it1=TList.begin();it1!=TList.end();it1++){
-                for (it2=it1+1;it2!=TList.end();it2++){
-                    if (*it1|*it2){
-                        it1->setCoef(it1->getCoef()+it2->getCoef());
-                        it2=TList.erase(it2);
-                        it2--;
-                    }
-                }
-                if (abs(it1->getCoef())<=0.00000001){
-                    it1=TList.erase(it1);
-                    it1--;
-                    // break;
-                }
-            }                    
+        void writeExpression(string& out, const Expression& e){
+            uint32_t n=e.TList.size();
+            putBytes(out,&n,sizeof(n));
+            for (int i=0;i<e.TList.size();i++){
+                CoefTraits<C>::write(out,e.TList[i].coef);
+                writeWord(out,e.TList[i].TList);
+            }
         }
         
-        // Symmetrization
+        void readWord(const char*& p, const char* end, Word& w){
+            uint32_t n, r;
+            if (!getBytes(p,end,&n,sizeof(n)) || (size_t)(end-p)/sizeof(r)<n) throw FormatError("truncated word");
+            w.clear();
+            for (uint32_t i=0;i<n;i++){
+                getBytes(p,end,&r,sizeof(r));
+                if (r>=size) throw FormatError("basis index out of range");
+                w.push_back((basis+r)->id);
+            }
+        }
         
-        Expression symmetrize(){
-            Expression ans;
-            for (int i=0;i<TList.size();i++){
-                ans=ans+symmetrize(TList[i]);
+        void readExpression(const char*& p, const char* end, Expression& e){
+            uint32_t n;
+            if (!getBytes(p,end,&n,sizeof(n))) throw FormatError("truncated expression");
+            e.TList.clear();
+            for (uint32_t i=0;i<n;i++){
+                Term t;
+                if (!CoefTraits<C>::read(p,end,t.coef)) throw FormatError("invalid coefficient");
+                readWord(p,end,t.TList);
+                e.TList.push_back(t);
             }
-            return ans;
         }
-};
-
-const Expression ZERO=Expression();
-          
-class LieAlgebra{
-    private:
-        BasisE *basis;
-        string *names;
-        Expression *ctable;
-        int size;
         
-        Expression& getR(int i,int j){// Gets commutator of basis
-            return *(ctable+size*i+j);
+        // Loads an algebra written by save()
+        void loadBinary(const char* p, size_t length){
+            const char* end=p+length;
+            uint32_t version, byteOrder, n;
+            string ring;
+            p+=sizeof(BINARY_MAGIC);
+            if (!getBytes(p,end,&version,sizeof(version)) || version!=BINARY_VERSION) throw FormatError("unsupported binary format version");
+            if (!getBytes(p,end,&byteOrder,sizeof(byteOrder)) || byteOrder!=0x01020304) throw FormatError("binary file has a different byte order");
+            if (!getString(p,end,ring)) throw FormatError("truncated header");
+            if (ring!=CoefTraits<C>::name()) throw FormatError("binary file uses coefficient ring '"+ring+"'");
+            if (!getBytes(p,end,&n,sizeof(n))) throw FormatError("truncated header");
+            size=n;
+            basis=new BasisE[size];
+            names=new string[size];
+            brackets.resize(size);
+            for (int i=0;i<size;i++){
+                if (!getString(p,end,*(names+i))) throw FormatError("truncated basis names");
+                (basis+i)->id=SymbolTable::instance().intern(names[i]);
+                (basis+i)->symbol=names[i];
+            }
+            indexBasis();
+            uint64_t count;
+            if (!getBytes(p,end,&count,sizeof(count))) throw FormatError("truncated structure constants");
+            Expression value;
+            for (uint64_t k=0;k<count;k++){
+                uint32_t ij[2];
+                if (!getBytes(p,end,ij,sizeof(ij))) throw FormatError("truncated structure constants");
+                if (ij[0]>=ij[1] || ij[1]>=n) throw FormatError("bracket index out of range");
+                readExpression(p,end,value);
+                brackets.set(ij[0],ij[1],value);
+            }
+            if (!getBytes(p,end,&count,sizeof(count))) throw FormatError("truncated normal form cache");
+            Word w;
+            for (uint64_t k=0;k<count;k++){
+                readWord(p,end,w);
+                readExpression(p,end,value);
+                nfCache.insert(w,value);
+            }
         }
         
-        bool setR(Expression e, int i, int j){// Sets commutator of basis
-            *(ctable+size*i+j)=e;
-            return true;
+        // Helpers for fromString
+        static bool isNameChar(char ch){
+            return !isspace((unsigned char)ch) && ch!='+' && ch!='-' && ch!='*' && ch!='/' && ch!='(' && ch!=')';
         }
         
-        string toComp(string exp){
-            string::iterator it;
-            for(it=exp.begin();it!=exp.end();it++){
-                if ((*it)=='-'){
-                    if (it==exp.begin()) continue;
-                    if (*(it-1)=='+') continue;
-                    it=exp.insert(it,'+');
+        static int precedence(char op){
+            if (op=='+' || op=='-') return 1;
+            if (op=='*' || op=='/') return 2;
+            return 3;   // unary minus
+        }
+        
+        bool isBasis(const string& name){
+            int id=SymbolTable::instance().find(name);
+            return id>=0 && id<rank.size() && rank[id]>=0;
+        }
+        
+        // Reads the number starting at exp[i] and advances i past it. An exponent is only read
+        // if the letters after the digits are not a basis element: 2e5 is 2*e5 if e5 exists.
+        C readNumber(const string& exp, size_t& i){
+            size_t end=i;
+            while (end<exp.size() && isDigit(exp[end])) end++;
+            if (end<exp.size() && exp[end]=='.'){
+                end++;
+                while (end<exp.size() && isDigit(exp[end])) end++;
+            }
+            if (end<exp.size() && (exp[end]=='e' || exp[end]=='E')){
+                size_t j=end+1;
+                if (j<exp.size() && (exp[j]=='+' || exp[j]=='-')) j++;
+                if (j<exp.size() && isDigit(exp[j])){
+                    size_t k=end;
+                    while (k<exp.size() && isNameChar(exp[k])) k++;
+                    if (!isBasis(exp.substr(end,k-end))){
+                        end=j;
+                        while (end<exp.size() && isDigit(exp[end])) end++;
+                    }
                 }
             }
-            return exp;       
+            size_t length;
+            C value=parseCoefficient<C>(exp.substr(i,end-i),&length);
+            i=end;
+            return value;
+        }
+        
+        // Replaces the top two operands by the result of the binary operator op (or the top
+        // operand by its negative for the unary minus 'n'). Sums are concatenated here and
+        // only combined once the whole string has been read.
+        void applyOperator(char op, size_t position, vector<Expression>& values){
+            Expression& rhs=values.back();
+            if (op=='n' || op=='-'){
+                for (int k=0;k<rhs.TList.size();k++) rhs.TList[k].coef=-rhs.TList[k].coef;
+                if (op=='n') return;
+            }
+            Expression& lhs=values[values.size()-2];
+            if (op=='+' || op=='-'){
+                lhs.TList.insert(lhs.TList.end(),rhs.TList.begin(),rhs.TList.end());
+            }
+            else if (op=='*'){
+                if (lhs.TList.size()==1 && rhs.TList.size()==1){
+                    lhs.TList[0]*=rhs.TList[0];
+                    if (CoefTraits<C>::isZero(lhs.TList[0].coef)) lhs.TList.clear();
+                }
+                else lhs=lhs*rhs;
+            }
+            else{
+                rhs.eliminate();
+                if (rhs.TList.empty()) throw InvalidExpression(position+1,"division by zero");
+                if (rhs.TList.size()>1 || rhs.TList[0].TList.size()>0){
+                    throw InvalidExpression(position+1,"can only divide by a number");
+                }
+                C inverse=C(1)/rhs.TList[0].coef;
+                for (int k=0;k<lhs.TList.size();k++) lhs.TList[k].coef=lhs.TList[k].coef*inverse;
+            }
+            values.pop_back();
         }
         
-
     public:
         friend class BasisE;
     
         // Constructors and Destructors
-        LieAlgebra(){}
+        BasicLieAlgebra():basis(0),names(0),bracketDegree(0),size(0),arenaEnabled(true){}
         
-        ~LieAlgebra(){
+        ~BasicLieAlgebra(){
             delete[] basis;
             delete[] names;
-            delete[] ctable;
         }
         
         // Reads Lie algebra description from file
-        LieAlgebra(string filen){
-            FILE * file = fopen(filen.c_str(), "r");
-                
-            if(!file){
-                throw FileNotFound();
+        // Both text descriptions and binary files written by save() are accepted.
+        BasicLieAlgebra(string filen):basis(0),names(0),bracketDegree(0),size(0),arenaEnabled(true){
+            MappedFile file(filen);
+            if (file.size()>=sizeof(BINARY_MAGIC) && memcmp(file.data(),BINARY_MAGIC,sizeof(BINARY_MAGIC))==0){
+                loadBinary(file.data(),file.size());
             }
-            
-            try{
-                    
-                char cpos[500];
-                if (!safe_getline(file, cpos)) throw FormatError();
-                size=atoi(cpos); // gets number of basis elements
-                basis=new BasisE[size];
-                names=new string[size];
-                ctable=new Expression[size*size]; // need change
-                    
-                for (int i=0;i<size;i++){
-                    if (!safe_getline(file, cpos)) throw FormatError();
-                    if (strlen(cpos) == 0) {
-                        i--;
-                        continue;
-                    }
-                    *(names+i)=string(cpos);
-                    (basis+i)->id=i;
-                    (basis+i)->symbol=names[i];
-                }
-
-                for (int i=1;i<size;i++)
-                    for (int j=0;j<i;j++)
-                        setR(fromString("0"),j,i);
-
-                while (safe_getline(file, cpos)){
-                    char arg1[500], arg2[500], out[500];
-                    int i;
-                    char * p;
-                    p = cpos;
-
-                    // Read in line of the form \b*[\b*\w+\b*,\b*\w+\b*]\b*=\b*.*
-                    if (strlen(p) == 0) continue;
-                    while (*(p++) == ' ');
-                    p--;
-                    if (*(p++) != '[') throw FormatError();
-                    while (*(p++) == ' ');
-                    p--;
-                    i = 0;
-                    while (*p != 0 && *p != ',' &&  *p != ' ') {
-                        arg1[i++] = *(p++);
-                    }
-                    while (*(p++) == ' ');
-                    p--;
-                    arg1[i] = 0;
-                    if (*p != ',') throw FormatError();
-                    p++;
-
-                    while (*(p++) == ' ');
-                    p--;
-                    i = 0;
-                    while (*p != 0 && *p != ']' &&  *p != ' ') {
-                        arg2[i++] = *(p++);
-                    }
-                    while (*(p++) == ' ');
-                    p--;
-                    arg2[i] = 0;
-                    if (*p != ']') throw FormatError();
-                    p++;
-                    while (*(p++) == ' ');
-                    p--;
-                    if (*p != '=') throw FormatError();
-                    p++;
-                    strcpy(out, p);
-
-                    // Now we have arguments and output
-                    int i1=getBasisRef(arg1);
-                    int i2=getBasisRef(arg2);
-                    if (i1>i2) setR(-fromString(out),min(i1,i2),max(i1,i2));
-                    else if (i1<i2) setR(fromString(out),min(i1,i2),max(i1,i2));
-                    
+            else{
+                load(string(file.data(),file.size()));
+            }
+            indexLinear();
+        }
+        
+        // Writes the algebra in a binary format that the constructor loads without any parsing:
+        //     "LIEALGB\0", format version, byte order mark, coefficient ring name,
+        //     basis names, nonzero brackets [x_i,x_j] (i<j), and cached normal forms.
+        // Words are stored as basis indices, so files do not depend on the process that wrote them.
+        // With includeCache the normal forms currently in the cache are stored too; the file can
+        // only be loaded with the same coefficient ring.
+        void save(string filename, bool includeCache=false){
+            string out;
+            uint32_t version=BINARY_VERSION, byteOrder=0x01020304, n=size;
+            putBytes(out,BINARY_MAGIC,sizeof(BINARY_MAGIC));
+            putBytes(out,&version,sizeof(version));
+            putBytes(out,&byteOrder,sizeof(byteOrder));
+            putString(out,CoefTraits<C>::name());
+            putBytes(out,&n,sizeof(n));
+            for (int i=0;i<size;i++){
+                putString(out,*(names+i));
+            }
+            uint64_t count=brackets.count();
+            putBytes(out,&count,sizeof(count));
+            for (int i=0;i<size;i++){
+                const vector<typename StructureConstants<C>::Entry>& row=brackets.row(i);
+                for (int k=0;k<row.size();k++){
+                    uint32_t ij[2]={(uint32_t)i,(uint32_t)row[k].col};
+                    putBytes(out,ij,sizeof(ij));
+                    writeExpression(out,row[k].value);
                 }
-
-                fclose(file);
             }
-            catch(...){
-                fclose(file);
-                throw FormatError();
-            }     
+            vector<std::pair<Word,Expression> > cached;
+            if (includeCache) cached=nfCache.snapshot();
+            count=cached.size();
+            putBytes(out,&count,sizeof(count));
+            for (int k=0;k<cached.size();k++){
+                writeWord(out,cached[k].first);
+                writeExpression(out,cached[k].second);
+            }
+
+            FILE * file = fopen(filename.c_str(), "wb");
+            if (!file) throw FileWriteError();
+            bool ok=fwrite(out.data(),1,out.size(),file)==out.size();
+            if (fclose(file)!=0 || !ok) throw FileWriteError();
         }
         
         // retrieval functions for basis elements
         BasisE& getBasisE(string name){
             return *(basis+getBasisRef(name));
         }
+        
+        BasisE& getBasisE(int i){
+            return *(basis+i);
+        }
+        
+        // number of basis elements
+        int getSize(){
+            return size;
+        }
+        
+        const StructureConstants<C>& structureConstants(){
+            return brackets;
+        }
              
         int getBasisRef(string name){
-            for (int i=0;i<size;i++){
-                if (*(names+i)==name) return i;
-            }
-            throw NoSuchBasis();
+            int id=SymbolTable::instance().find(name);
+            if (id<0) throw NoSuchBasis();
+            return rankOf(id);
         }
         
         // returns Lie algebra with same basis but in which all commutators are zero
-        LieAlgebra SymmetricAlgebra(){
-                LieAlgebra g1;
+        BasicLieAlgebra SymmetricAlgebra(){
+                BasicLieAlgebra g1;
                 g1.size=size;
-                Expression zero;
                 g1.basis=new BasisE[size];
                 g1.names=new string[size];
-                g1.ctable=new Expression[size*size];// need change
+                g1.brackets.resize(size);
                 for (int i=0;i<size;i++){
                     *(g1.names+i)=*(names+i);
                     (g1.basis+i)->id=(basis+i)->id;
                     (g1.basis+i)->symbol=(basis+i)->symbol;
                 }
-                for (int i=0;i<size;i++){
-                    for (int j=i+1;j<size;j++){
-                        g1.setR(zero,i,j);
-                    }
-                }
+                g1.rank=rank;
+                g1.indexLinear();
                 return g1;
         }
         
@@ -735,94 +2658,157 @@ class LieAlgebra{
         // Converts string to expression
         // As this depends on the Lie algebra description, it is a method of the Lie algebra, not expression.
         // For instance, a*b is a valid expression only if the lie algebra description includes a and b.
-        Expression fromString(string exp){
-            exp=toComp(exp);
-            try{
-                Term curT;
-                Expression curE;
-                Expression curParen;
-                string curBstr="";
-                string curTstr="";
-                string::iterator it;
-                bool recurse=true;
-                double a;
-
-                stringstream transformer;
-
-                // Remove spaces
-                for (int i = 0; i < exp.length(); i++) {
-                    if (exp[i] != ' ') transformer << exp[i];
-                }
-                
-                exp = transformer.str();
-
-                if (exp == "") return Expression();
-                if (exp == "0"){
-                    return Expression();
-                }
-
-                int i = 0;
-                if (exp[0] == '(') {
-                    int count = 1;
-                    int j = 0;
-                    for (j = 1; j < exp.length(); j++) {
-                        if (exp[j] == '(') count++;
-                        if (exp[j] == ')') count--;
-                        if (count == 0) break;
+        // Expressions are sums and differences of products, with parentheses, unary minus and division
+        // by numbers (e*f/2). A number or ')' followed by a basis element or '(' multiplies it (2e*f,
+        // 3(e+f)). Numbers may have a fractional part and an exponent (0.5, 1.5e-3).
+        // The string is read once from left to right, keeping pending operators and operands on explicit
+        // stacks, so long inputs take linear time and no recursion. Errors report their column.
+        Expression fromString(const string& exp){
+            EngineCounters::Timer timer(counters,EngineCounters::PARSE);
+            vector<Expression> values;
+            vector<char> ops;           // pending operators: + - * / 'n' (unary minus) and '('
+            vector<size_t> positions;   // where each pending operator is in exp
+            bool operand=true;          // whether an operand is expected next
+            size_t i=0;
+            while (true){
+                while (i<exp.size() && isspace((unsigned char)exp[i])) i++;
+                if (i==exp.size()) break;
+                char ch=exp[i];
+                if (operand){
+                    if (ch=='(' || ch=='-'){
+                        ops.push_back(ch=='(' ? '(' : 'n');
+                        positions.push_back(i++);
                     }
-                    curE = fromString(exp.substr(1, j-1));
-                    i = j+1;
-                }
-                else if (exp[0] != '*' && exp[0] != '+'){
-                    int j = 0;
-                    int last = 0;
-                    double coefficient;
-                    string term_str;
-                    for (j = 0; j < exp.length(); j++) {
-                        if (exp[j] == '(' || exp[j] == '+' || (exp[j] == '-' && j!=0)) break;
-                        else if (exp[j] != '*') last = j;
+                    else if (ch=='+'){
+                        i++;
                     }
-
-                    coef(exp.substr(0, last + 1), &coefficient, &term_str);
-                    vector<string> basis_elements_str;
-                    Term a;
-                    a.setCoef(coefficient);
-                    split(term_str, '*', &basis_elements_str);
-                    for (int k = 0; k < basis_elements_str.size(); k++) {
-                        a *= getBasisE(basis_elements_str[k]);
+                    else if (isDigit(ch)){
+                        Term t;
+                        size_t start=i;
+                        try{
+                            t.setCoef(readNumber(exp,i));
+                        }
+                        catch(exception& e){
+                            throw InvalidExpression(start+1,e.what());
+                        }
+                        values.push_back(CoefTraits<C>::isZero(t.coef) ? Expression() : Expression(t));
+                        operand=false;
+                    }
+                    else if (isNameChar(ch)){
+                        size_t start=i;
+                        while (i<exp.size() && isNameChar(exp[i])) i++;
+                        string name=exp.substr(start,i-start);
+                        if (!isBasis(name)) throw InvalidExpression(start+1,"unknown basis element '"+name+"'");
+                        values.push_back(Expression(getBasisE(name)));
+                        operand=false;
                     }
-                    curE = Expression(a);
-                    i = last + 1;
+                    else throw InvalidExpression(i+1,"expected a number, basis element or '('");
                 }
-                else {
-                    throw InvalidExpression();
+                else if (ch==')'){
+                    while (!ops.empty() && ops.back()!='('){
+                        applyOperator(ops.back(),positions.back(),values);
+                        ops.pop_back();
+                        positions.pop_back();
+                    }
+                    if (ops.empty()) throw InvalidExpression(i+1,"unmatched ')'");
+                    ops.pop_back();
+                    positions.pop_back();
+                    i++;
+                }
+                else{
+                    char op='*';
+                    if (ch=='+' || ch=='-' || ch=='*' || ch=='/') op=ch;
+                    while (!ops.empty() && ops.back()!='(' && precedence(ops.back())>=precedence(op)){
+                        applyOperator(ops.back(),positions.back(),values);
+                        ops.pop_back();
+                        positions.pop_back();
+                    }
+                    ops.push_back(op);
+                    positions.push_back(i);
+                    if (op==ch) i++;
+                    operand=true;
                 }
-
-                if (i == exp.length()) return curE;
-
-                if (exp[i] == '*') return curE * fromString(exp.substr(i+1));
-                else if (exp[i] == '+') return curE + fromString(exp.substr(i+1));
-                else if (exp[i] == '-') return curE - fromString(exp.substr(i+1));
-                else throw InvalidExpression();
             }
-            catch(...){
-                throw InvalidExpression();
+            if (operand){
+                if (values.empty() && ops.empty()) return Expression();
+                throw InvalidExpression(exp.size()+1,"unexpected end of expression");
+            }
+            while (!ops.empty()){
+                if (ops.back()=='(') throw InvalidExpression(positions.back()+1,"unmatched '('");
+                applyOperator(ops.back(),positions.back(),values);
+                ops.pop_back();
+                positions.pop_back();
             }
+            Expression result=std::move(values.back());
+            result.eliminate();
+            return result;
         }        
           
         // commutators  
         Expression commutator(BasisE &x1, BasisE &x2){
-            int i1=getBasisRef(x1.symbol);
-            int i2=getBasisRef(x2.symbol);
+            return commutator(x1.id,x2.id);
+        }
+        
+        // Commutator of two basis elements given by symbol id
+        Expression commutator(int id1, int id2){
+            int i1=rankOf(id1);
+            int i2=rankOf(id2);
             Expression ans;
             if (i1==i2) return ans;
-            if (i1>i2) return -commutator(x2,x1);
-            return getR(min(i1,i2),max(i1,i2));
+            if (i1>i2) return -getR(i2,i1);
+            return getR(i1,i2);
         }
         
+        // [x,y] in normal form.
+        // When one word of a pair is a single factor g and the other, u=u_1...u_p, is ordered, the
+        // Leibniz rule
+        //     [u,g] = sum over i of u_1...u_i-1 [u_i,g] u_i+1...u_p
+        // gives words that are already ordered up to one bracket, instead of the products u*g and
+        // g*u, whose leading parts cancel (this is the case of central element checks). Other pairs
+        // contribute u*v-v*u. All words are combined and normal ordered in one worklist; the Leibniz
+        // words are not worth caching, so input caching is only kept when every pair was expanded.
         Expression commutator(Expression x, Expression y){
+            return commutator(std::move(x),std::move(y),truncation);
+        }
+        
+        // [x,y] in normal form, truncated by trunc
+        Expression commutator(Expression x, Expression y, const Truncation& trunc){
             try{
-                return Simplify(x*y-y*x);
+                Expression expansion;
+                bool leibniz=false;
+                {
+                    EngineCounters::Timer timer(counters,EngineCounters::MULTIPLY);
+                    TermAccumulator<C> acc;
+                    Word w;
+                    typename vector<Term>::const_iterator t1, t2;
+                    for (t1=x.TList.begin();t1!=x.TList.end();t1++){
+                        for (t2=y.TList.begin();t2!=y.TList.end();t2++){
+                            C c=t1->coef*t2->coef;
+                            if (CoefTraits<C>::isZero(c)) continue;
+                            const Word& u=t1->TList;
+                            const Word& v=t2->TList;
+                            if (u.empty() || v.empty()) continue;
+                            if (v.size()==1 && isOrdered(u)){
+                                addLeibniz(acc,u,v[0],c);
+                                leibniz=true;
+                            }
+                            else if (u.size()==1 && isOrdered(v)){
+                                addLeibniz(acc,v,u[0],-c);
+                                leibniz=true;
+                            }
+                            else{
+                                w=u;
+                                w.append(v.begin(),v.end());
+                                acc.add(w,c);
+                                w=v;
+                                w.append(u.begin(),u.end());
+                                acc.add(w,-c);
+                            }
+                        }
+                    }
+                    acc.release(expansion.TList);
+                }
+                return normalOrder(std::move(expansion),!leibniz,trunc);
             }
             catch(...){
                 throw InvalidExpression();
@@ -831,23 +2817,21 @@ class LieAlgebra{
         
         // Poisson bracket ({a*b,c}=a*{b,c}+{a,c}*b, and {a,b}=[a,b] for basis elements)
         Expression poisson(Term x, BasisE& y){
-            vector<BasisE>::iterator it;
             Expression ans;
-            for (it=x.TList.begin(); it!=x.TList.end();it++){
+            for (int i=0;i<x.TList.size();i++){
                 Term temp;
-                vector<BasisE>::iterator it1;
-                for (it1=x.TList.begin(); it1!=x.TList.end();it1++){
-                    if (it1==it) continue;
-                    temp.TList.push_back(*it1);
+                for (int k=0;k<x.TList.size();k++){
+                    if (k==i) continue;
+                    temp.TList.push_back(x.TList[k]);
                 }
                 temp.coef=x.coef;
-                ans=ans+Expression(temp)*commutator(*it,y);
+                ans+=Expression(std::move(temp))*commutator(x.TList[i],y.id);
             }
             return ans;
         }
         
         Expression poisson(Expression x, BasisE& y){
-            vector<Term>::iterator it;
+            typename vector<Term>::iterator it;
             Expression ans;
             for (it=x.TList.begin();it!=x.TList.end();it++){
                 ans+= poisson(*it,y);
@@ -856,26 +2840,193 @@ class LieAlgebra{
         }
             
         
+        // The image of x in the symmetric algebra: a polynomial in the variables x_i = basis element i
+        Polynomial toPolynomial(const Expression& x){
+            Polynomial p(size);
+            typename vector<Term>::const_iterator it;
+            for (it=x.TList.begin();it!=x.TList.end();it++){
+                Monomial m(size);
+                for (int k=0;k<it->TList.size();k++) m.multiplyVariable(rankOf(it->TList[k]));
+                p.add(m,it->coef);
+            }
+            return p;
+        }
+        
+        // The expression with the ordered monomials of p, highest degree first
+        Expression fromPolynomial(const Polynomial& p){
+            if (!p.isZero() && p.variables()!=size) throw VariableMismatch();
+            vector<std::pair<Monomial,C> > terms=p.sortedTerms();
+            Expression ans;
+            ans.TList.reserve(terms.size());
+            for (int t=0;t<terms.size();t++){
+                Term term;
+                term.coef=terms[t].second;
+                for (int i=0;i<size;i++){
+                    for (int e=terms[t].first.exponent(i);e>0;e--) term.TList.push_back((basis+i)->id);
+                }
+                ans.TList.push_back(std::move(term));
+            }
+            return ans;
+        }
+        
+        // Poisson bracket of polynomials in the symmetric algebra,
+        //     {P,Q} = sum over i<j of (dP/dx_i dQ/dx_j - dP/dx_j dQ/dx_i) [x_i,x_j]
+        // with the brackets read as polynomials. Only nonzero brackets between variables
+        // occurring in P or Q are visited.
+        Polynomial poisson(const Polynomial& p, const Polynomial& q){
+            if ((!p.isZero() && p.variables()!=size) || (!q.isZero() && q.variables()!=size)) throw VariableMismatch();
+            vector<Polynomial> dp, dq;
+            for (int i=0;i<size;i++){
+                dp.push_back(p.derivative(i));
+                dq.push_back(q.derivative(i));
+            }
+            Polynomial ans(size), coef(size), minus(size);
+            for (int i=0;i<size;i++){
+                const vector<typename StructureConstants<C>::Entry>& row=brackets.row(i);
+                for (int k=0;k<row.size();k++){
+                    int j=row[k].col;
+                    coef=Polynomial(size);
+                    coef.addProduct(dp[i],dq[j]);
+                    if (!dp[j].isZero() && !dq[i].isZero()){
+                        minus=-dp[j];
+                        coef.addProduct(minus,dq[i]);
+                    }
+                    if (coef.isZero()) continue;
+                    ans.addProduct(coef,toPolynomial(row[k].value));
+                }
+            }
+            return ans;
+        }
+        
+        // Whether every bracket of basis elements is a linear combination of basis elements
+        bool isLinear(){
+            return linearBrackets.allLinear();
+        }
+        
+        // The matrix of ad x_i in the basis, (ad x_i)[k][j] = coefficient of x_k in [x_i,x_j].
+        // Throws NotLinear unless isLinear().
+        vector<vector<C> > adjointMatrix(int i){
+            if (!isLinear()) throw NotLinear();
+            if (i<0 || i>=size) throw NoSuchBasis();
+            vector<C> a=linearBrackets.adjoint(i);
+            vector<vector<C> > ans(size);
+            for (int k=0;k<size;k++) ans[k].assign(a.begin()+k*size,a.begin()+(k+1)*size);
+            return ans;
+        }
+        
+        // The Killing form, K[i][j] = tr(ad x_i ad x_j), computed by threads workers (0 for one per
+        // core). Throws NotLinear unless isLinear().
+        vector<vector<C> > killingForm(int threads=0){
+            if (!isLinear()) throw NotLinear();
+            vector<C> K=linearBrackets.killing(threads);
+            vector<vector<C> > ans(size);
+            for (int i=0;i<size;i++) ans[i].assign(K.begin()+i*size,K.begin()+(i+1)*size);
+            return ans;
+        }
+        
+        // The quadratic Casimir element of the Killing form (see casimir(form)). Throws NotLinear
+        // unless isLinear(), and DegenerateForm if the algebra is not semisimple.
+        Expression casimir(int threads=0){
+            return casimir(killingForm(threads));
+        }
+        
+        // The quadratic Casimir element sum over i,j of B^ij x_i x_j in normal form, where (B^ij) is
+        // the inverse of the matrix form[i][j] of a nondegenerate bilinear form on the basis. It is
+        // central when the form is invariant, B([x,y],z)=B(x,[y,z]). Throws DegenerateForm if the
+        // form cannot be inverted.
+        Expression casimir(const vector<vector<C> >& form){
+            if (form.size()!=size) throw DegenerateForm();
+            vector<C> inverse;
+            inverse.reserve((size_t)size*size);
+            for (int i=0;i<size;i++){
+                if (form[i].size()!=size) throw DegenerateForm();
+                inverse.insert(inverse.end(),form[i].begin(),form[i].end());
+            }
+            if (!invertMatrix(inverse,size)) throw DegenerateForm();
+            Expression ans;
+            for (int i=0;i<size;i++){
+                for (int j=0;j<size;j++){
+                    const C& b=inverse[(size_t)i*size+j];
+                    if (CoefTraits<C>::isZero(b)) continue;
+                    Term t;
+                    t.TList.push_back((basis+i)->id);
+                    t.TList.push_back((basis+j)->id);
+                    t.coef=b;
+                    ans.TList.push_back(std::move(t));
+                }
+            }
+            return normalOrder(std::move(ans),false);
+        }
+        
         // Checks if the Jacobi identity is satisified.
         bool checkJacobi(){
+            return jacobiFailures(0,true).empty();
+        }
+        
+        // Checks the Jacobi identity on all basis triples i<j<k, returning the triples where it fails.
+        // The pairs (i,j) are distributed over threads workers (0 for one per core); the algebra is
+        // only read. With stopAtFirst the check ends as soon as some failure is found, and only the
+        // failures found up to then are returned. Failures are listed in order of (i,j,k).
+        vector<JacobiFailure<C> > jacobiFailures(int threads=0, bool stopAtFirst=false){
+            vector<std::pair<int,int> > pairs;
             for (int i=0; i<size; i++){
                 for (int j=i+1; j<size; j++){
-                    for (int k=j+1; k<size; k++){
-                        Expression x1=Expression(*(basis+i));
-                        Expression x2=Expression(*(basis+j));
-                        Expression x3=Expression(*(basis+k));
-                        Expression check=commutator(commutator(x1,x2),x3)+commutator(commutator(x2,x3),x1)+commutator(commutator(x3,x1),x2);
-                        check=Simplify(check);
-                        if (!check.isZero()) return false;
-                    }
+                    pairs.push_back(std::make_pair(i,j));
                 }
             }
-            return true;
+            vector<vector<JacobiFailure<C> > > found(pairs.size());
+            std::atomic<bool> stop(false);
+            parallelFor(pairs.size(),threads,[&](size_t p){
+                int i=pairs[p].first, j=pairs[p].second;
+                for (int k=j+1; k<size && !stop.load(); k++){
+                    JacobiFailure<C> failure;
+                    failure.i=i;
+                    failure.j=j;
+                    failure.k=k;
+                    failure.residue=jacobiResidue(i,j,k);
+                    if (failure.residue.isZero()) continue;
+                    found[p].push_back(failure);
+                    if (stopAtFirst) stop=true;
+                }
+            },&stop);
+            vector<JacobiFailure<C> > failures;
+            for (int p=0;p<found.size();p++){
+                failures.insert(failures.end(),found[p].begin(),found[p].end());
+            }
+            return failures;
+        }
+        
+        // [[x_i,x_j],x_k]+[[x_j,x_k],x_i]+[[x_k,x_i],x_j] in normal form. When all the brackets
+        // involved are linear, this is a contraction of the dense structure constants. Otherwise the
+        // inner brackets are read from the structure constants, and the three outer commutators are
+        // normal ordered together.
+        Expression jacobiResidue(int i, int j, int k){
+            if (linearBrackets.linearOuter(i,j,k) && linearBrackets.linearOuter(j,k,i) && linearBrackets.linearOuter(k,i,j)){
+                vector<C> residue(size);
+                linearBrackets.jacobi(i,j,k,&residue[0]);
+                Expression ans;
+                for (int m=0;m<size;m++){
+                    if (CoefTraits<C>::isZero(residue[m])) continue;
+                    Term t;
+                    t.TList.push_back((basis+m)->id);
+                    t.coef=residue[m];
+                    ans.TList.push_back(std::move(t));
+                }
+                return ans;
+            }
+            Expression x1=Expression(*(basis+i));
+            Expression x2=Expression(*(basis+j));
+            Expression x3=Expression(*(basis+k));
+            Expression r12=getR(i,j), r23=getR(j,k), r31=-getR(i,k);
+            Expression check=r12*x3-x3*r12+r23*x1-x1*r23+r31*x2-x2*r31;
+            return normalOrder(check);
         }
         
         
         // returns the side effect of flipping i-th and j-th basis element in given term. The term itself is not included
         Expression flipwc(Term a, int i, int j){
+            counters.countFlipwc();
+            EngineCounters::Timer timer(counters,EngineCounters::MULTIPLY);
             int index;
             int temp=i;
             i=min(i,j);
@@ -887,14 +3038,9 @@ class LieAlgebra{
                 Term h1, h2;
                 h1.setCoef(a.getCoef());
                 h2.setCoef(1);
-                vector<BasisE>::iterator it;
-                for (it=cur.TList.begin();it!=(cur.TList.begin()+i+index);it++){
-                    h1*=(*it); // Grabs first half
-                }
-                for (it=cur.TList.begin()+i+index+2;it!=cur.TList.end();it++){
-                    h2*=(*it); // Grabs second half
-                }
-                ans+=(Expression(h1)*commutator(*(cur.TList.begin()+i+index),*(cur.TList.begin()+i+index+1)))*Expression(h2);
+                h1.TList.append(cur.TList.begin(),cur.TList.begin()+i+index); // Grabs first half
+                h2.TList.append(cur.TList.begin()+i+index+2,cur.TList.end()); // Grabs second half
+                ans+=(Expression(h1)*commutator(cur.TList[i+index],cur.TList[i+index+1]))*Expression(h2);
                 cur=vflip(cur,i+index,i+index+1);
             }
             
@@ -902,14 +3048,9 @@ class LieAlgebra{
                 Term h1, h2;
                 h1.setCoef(a.getCoef());
                 h2.setCoef(1);
-                vector<BasisE>::iterator it;
-                for (it=cur.TList.begin();it!=(cur.TList.begin()+j-index-2);it++){
-                    h1*=(*it);
-                }
-                for (it=cur.TList.begin()+j-index;it!=cur.TList.end();it++){
-                    h2*=(*it);
-                }
-                ans+=(Expression(h1)*commutator(*(cur.TList.begin()+j-index-2),*(cur.TList.begin()+j-index-1)))*Expression(h2);
+                h1.TList.append(cur.TList.begin(),cur.TList.begin()+j-index-2);
+                h2.TList.append(cur.TList.begin()+j-index,cur.TList.end());
+                ans+=(Expression(h1)*commutator(cur.TList[j-index-2],cur.TList[j-index-1]))*Expression(h2);
                 cur=vflip(cur,j-index-2,j-index-1);
             }    
             ans.eliminate();
@@ -918,7 +3059,7 @@ class LieAlgebra{
         
         // flips i-th and j-th entry of term without regarding side-effects. 
         Term vflip(Term a, int i, int j){
-            BasisE temp;
+            int temp;
             temp=a.TList[i];
             a.TList[i]=a.TList[j];
             a.TList[j]=temp;
@@ -927,131 +3068,381 @@ class LieAlgebra{
 
         // returns an expression equal to the term (as dictated by the lie algebra), with two basis elements of term swapped in position
         Expression flip(Term a, int i, int j){
+            counters.countFlip();
             int temp=i;
             i=min(i,j);
             j=max(temp,j);
             return Expression(vflip(a,i,j))+flipwc(a,i,j);
         }
         
-        // Applies Lie algebra rules to "simplify" expression"
-        // The resulting expression may actually be longer than the original,
-        // but no two terms in result will have the same multiplicities of basis elements.
-        // In particular, a zero expression will always get simplified to 0.
+        // Applies Lie algebra rules to "simplify" expression.
+        // The result is the PBW normal form of the expression (see normalOrder),
+        // so no two terms have the same word and a zero expression always simplifies to 0.
         Expression Simplify(Expression a){
-            vector<Term>::iterator Tit1, Tit2;
-            
-            a.eliminate(); // First get rid of easy stuff
+            return normalOrder(std::move(a),true,truncation);
+        }
+        
+        // x^n in normal form (x^0=1), normal ordering after every multiplication. Each x^k is either
+        // x^(k-1)*x or the square of x^(k/2), whichever the cost estimate (see productCost) finds
+        // cheaper in total. Squaring takes fewer steps but merges two long words per term pair, so
+        // it is chosen when x has few terms, and repeated multiplication by x otherwise.
+        // The truncation (see setTruncation) is applied to the result, and also after every step
+        // when it keeps the top degree of an algebra with linear brackets, where that is exact.
+        Expression power(const Expression& x, int n){
+            if (n<0) throw InvalidExpression();
+            Truncation trunc=stepTruncation();
+            Expression base=normalOrder(x,true,trunc);
+            Expression ans;
+            if (n==0){
+                ans.TList.push_back(Term());
+                ans.TList[0].coef=C(1);
+                truncate(ans,truncation);
+                return ans;
+            }
             
-            // static int bad=0;
-            // static int loops=0;
-            try{
-            for (Tit1=a.TList.begin();Tit1!=a.TList.end();Tit1++){
-                for (Tit2=Tit1+1; Tit2!=a.TList.end();Tit2++){
-                    // loops++;
-                    if (Tit2->TList.size()!=Tit1->TList.size()) continue; // Easy way out
-                    // shouldskip=(Tit2->hash()!=Tit1->hash());
-                    if (Tit2->hash()!=Tit1->hash()) continue; // another way out
-                    vector<BasisE>::iterator Bit1,Bit2;
-                    vector<int> Permutation;
-                    bool added_list[Tit2->TList.size()];
-                    for (int i=0;i<Tit2->TList.size();i++){
-                        added_list[i]=false;
-                    }
-                    int i1, next;
-                    bool isPerm=true;
-                    
-                    for (Bit1=Tit1->TList.begin();Bit1!=Tit1->TList.end();Bit1++){
-                        i1=0;
-                        bool found=false;
-                        for (Bit2=Tit2->TList.begin();Bit2!=Tit2->TList.end();Bit2++){
-                            if (Bit2->toString()==Bit1->toString()){
-                                vector<int>::iterator Iit;
-                                if (!added_list[i1]){
-                                    Permutation.push_back(i1);
-                                    found=true;
-                                    added_list[i1]=true;
-                                    break;
-                                }
-                            }
-                            i1++;
+            // best[k] is the estimated cost of computing x^k, squared[k] whether it squares
+            int d=degreeOf(base);
+            vector<double> best(n+1,0);
+            vector<bool> squared(n+1,false);
+            vector<ProductEstimate> est(n+1);
+            est[1]=estimate(base.TList.size(),d);
+            for (int k=2;k<=n;k++){
+                est[k]=estimateProduct(est[k-1],est[1]);
+                best[k]=best[k-1]+productCost(est[k-1],est[1]);
+                if (k%2==0 && best[k/2]+productCost(est[k/2],est[k/2])<best[k]){
+                    best[k]=best[k/2]+productCost(est[k/2],est[k/2]);
+                    squared[k]=true;
+                }
+            }
+            vector<int> chain; // the exponents computed, from n down
+            for (int k=n;k>1;k=squared[k] ? k/2 : k-1) chain.push_back(k);
+            ans=base;
+            for (int c=chain.size()-1;c>=0;c--){
+                const Truncation& t=(c==0 ? truncation : trunc);
+                if (squared[chain[c]]) ans=multiply(ans,ans,t);
+                else ans=multiply(ans,base,t);
+            }
+            truncate(ans,truncation);
+            return ans;
+        }
+        
+        // factors[0]*...*factors[k-1] in normal form, normal ordering every partial product. The
+        // association order minimizes the total estimated cost (see productCost) by dynamic
+        // programming over the intervals of factors, as for a chain of matrix products.
+        // Truncation is applied as in power.
+        Expression product(const vector<Expression>& factors){
+            Truncation trunc=stepTruncation();
+            int k=factors.size();
+            Expression ans;
+            if (k==0){
+                ans.TList.push_back(Term());
+                ans.TList[0].coef=C(1);
+                truncate(ans,truncation);
+                return ans;
+            }
+            vector<Expression> f(k);
+            for (int i=0;i<k;i++){
+                f[i]=normalOrder(factors[i],true,trunc);
+                if (f[i].isZero()) return ans;
+            }
+            vector<vector<double> > cost(k,vector<double>(k,0));
+            vector<vector<int> > split(k,vector<int>(k,0));
+            vector<vector<ProductEstimate> > est(k,vector<ProductEstimate>(k));
+            for (int i=0;i<k;i++) est[i][i]=estimate(f[i].TList.size(),degreeOf(f[i]));
+            for (int len=2;len<=k;len++){
+                for (int i=0;i+len-1<k;i++){
+                    int j=i+len-1;
+                    est[i][j]=estimateProduct(est[i][i],est[i+1][j]);
+                    for (int s=i;s<j;s++){
+                        double c=cost[i][s]+cost[s+1][j]+productCost(est[i][s],est[s+1][j]);
+                        if (s==i || c<cost[i][j]){
+                            cost[i][j]=c;
+                            split[i][j]=s;
                         }
-                        if (found) continue;
-                        isPerm=false;
-                        break;
                     }
-                    if (!isPerm) continue;
-            // Now, we know it is permutation
-            // What does Permutation tell us? That the ith of the first term gets sent to Permutation[i]th of second
-            
-                    Expression newTerms;
-                    Term curterm=*Tit1;
-                    int curperm[Tit1->TList.size()];
-                    
-                    for (int j=0;j<Tit1->TList.size();j++){
-                        curperm[j]=j;
+                }
+            }
+            if (k==1) ans=f[0];
+            else{
+                int s=split[0][k-1];
+                ans=multiply(productRange(f,split,0,s,trunc),productRange(f,split,s+1,k-1,trunc),truncation);
+            }
+            truncate(ans,truncation);
+            return ans;
+        }
+        
+        // Rewrites every word of a into PBW order (nondecreasing basis index) using the
+        // commutation relations, and returns the resulting normal form.
+        // Normal forms of the words of a are kept in a cache (see setCacheLimit), so words
+        // that were normal ordered before, by any call, are not rewritten again.
+        // Terms of the result are ordered by decreasing degree, then by basis index.
+        // The worklist, intermediate words and accumulated terms live in the thread's arena
+        // (see setArena), and only the normal forms that are kept are copied to the heap.
+        // With cacheInputs false the words of a are neither looked up nor stored in the cache
+        // (only the words they are rewritten into are looked up), which suits many one-off words.
+        // Only the terms that trunc keeps are returned (see expand); truncated normal forms are never
+        // cached, so truncating also turns off cacheInputs.
+        Expression normalOrder(Expression a, bool cacheInputs=true, const Truncation& trunc=Truncation()){
+            if (!trunc.none()) cacheInputs=false;
+            counters.countNormalOrder();
+            EngineCounters::Timer timer(counters,EngineCounters::NORMAL_ORDER);
+            Expression ans;
+            {
+                ArenaScope scope(arenaEnabled);
+                PendingMap pending;
+                TermAccumulator<C> result(a.TList.size());
+                typename vector<Term>::iterator it;
+                for (it=a.TList.begin();it!=a.TList.end();it++){
+                    if (CoefTraits<C>::isZero(it->coef)) continue;
+                    if (!cacheInputs || nfCache.getLimit()==0 || isOrdered(it->TList)){
+                        addPending(pending,it->TList,it->coef);
+                        continue;
                     }
-                    //////////////////////////////////////////////
-                    ///// Explanation of the following Loop
-                    //////////////////////////////////////////////
-                    /*
-                        The curperm[i] tracks the original location of the elements of the first term.
-                        More exactly, curperm[i] tells the original location of ith term.
-                        Say the first term was x1*x2*x3*x4*x5 and the second term was x2*x4*x5*x3*x1
-                        We start with the first element of term1, which is curterm.
-                        We check where it is supposed to be-It is supposed to be at Permutation[0] of second term
-                        Are the 0th and Permutation[0]th elements of the first term equal? 
-                        If they are, we do not need to do anything.Otherwise, let us flip the first term.
-                        In this case, they are not equal, so we flip first term from 0 to Permutation[curperm[0]]=4. What do we get?
-                        We get x5*x2*x3*x4*x1+other terms. Let us ignore the other terms for sake of argument.
-                        We set curperm[0]=4
-                        and curperm[4]=0
-                        We check again. Is the current 0th element equal to Permutation[curperm[0]=4]=2 of current? No. 
-                        So we get x3*x2*x5*x4*x1
-                        We set curperm[0]=2
-                        curperm[2]=4
-                        ->0=Permutation[curperm[0]]->curterm[0]=curterm[Permutation[2]=3]? no.
-                        curterm->x4*x2*x5*x3*x1
-                        curperm[0]=3
-                        curperm[3]=2
-                        ->curterm[0]=curterm[Permutation[curperm[0]]]? No., ...etc
-                    */
-                    for (int i=0; i<Tit1->TList.size();i++){
-                        for(;;){
-                            int t1;
-                            next=Permutation[curperm[i]];
-                            if (curterm.TList[next].toString()==curterm.TList[i].toString()) break;
-                            newTerms=newTerms+flipwc(curterm,min(next,i),max(next,i));
-                            curterm=vflip(curterm,min(next,i),max(next,i));
-                            t1=curperm[i];
-                            curperm[i]=curperm[next];
-                            curperm[next]=t1;
-                        }
+                    Expression nf;
+                    if (!nfCache.lookup(it->TList,nf)){
+                        PendingMap single;
+                        TermAccumulator<C> nfTerms;
+                        addPending(single,it->TList,C(1));
+                        expand(single,nfTerms);
+                        nfTerms.release(nf.TList);
+                        std::sort(nf.TList.begin(),nf.TList.end(),NormalOrderLess(this));
+                        ArenaPause pause;
+                        nfCache.insert(it->TList,nf);
+                    }
+                    for (int i=0;i<nf.TList.size();i++){
+                        result.add(nf.TList[i].TList,it->coef*nf.TList[i].coef);
                     }
-                    *Tit1=curterm;
-                    return Simplify(a+newTerms);
                 }
+                expand(pending,result,trunc);
+                ArenaPause pause;
+                result.release(ans.TList);
             }
+            std::sort(ans.TList.begin(),ans.TList.end(),NormalOrderLess(this));
+            truncate(ans,trunc);
+            return ans;
+        }
+        
+        // Restricts the results of Simplify, commutator, power, product and symmetrize(Expression) to
+        // the terms that t keeps: Truncation(d) discards terms of degree above d, Truncation(-1,true)
+        // keeps only the top-degree part. Terms are dropped while normal ordering, as soon as no other
+        // term can cancel them, so truncated computations hold fewer terms. Operations that need
+        // complete normal forms (center, isCentral, centralResidues, checkJacobi, casimir) ignore the
+        // truncation.
+        // Products of truncated results are not truncations of the exact products in general, as
+        // rewriting lowers degrees; for an algebra with linear brackets the top-degree part is.
+        void setTruncation(const Truncation& t){
+            truncation=t;
+        }
+        
+        const Truncation& getTruncation() const{
+            return truncation;
+        }
+        
+        // Turns the arena (see Arena) used by normal ordering on or off. It is on by default;
+        // off, every intermediate word and worklist entry is allocated from the heap.
+        void setArena(bool on){
+            arenaEnabled=on;
+        }
+        
+        // The symmetrization of a (see Expression::symmetrize) in normal form.
+        // Rearrangements are not enumerated. Grouping them by their first factor gives
+        //     sym(M) = sum over distinct factors x of M of (m_x/n) x*sym(M-x)
+        // for a multiset M of n factors, x occurring m_x times. So the normal form of sym(M) is
+        // computed from those of its sub-multisets, which are shared between all the terms of a.
+        // A word of n distinct factors needs 2^n normal orderings instead of n! words.
+        Expression symmetrize(const Expression& a){
+            std::unordered_map<Word,Expression,WordHash> memo;
+            TermAccumulator<C> result;
+            Word factors;
+            for (int i=0;i<a.TList.size();i++){
+                factors=a.TList[i].TList;
+                std::sort(factors.begin(),factors.end(),RankLess(this));
+                const Expression& nf=symmetrizedNormalForm(factors,memo);
+                for (int k=0;k<nf.TList.size();k++){
+                    result.add(nf.TList[k].TList,a.TList[i].coef*nf.TList[k].coef);
+                }
             }
-            catch(...){
-                return a;
-            }
-            
-            return a;
+            Expression ans;
+            result.release(ans.TList);
+            std::sort(ans.TList.begin(),ans.TList.end(),NormalOrderLess(this));
+            truncate(ans,truncation);
+            return ans;
+        }
+        
+        // Sets the memory limit (in bytes) of the normal form cache; 0 disables it
+        void setCacheLimit(size_t bytes){
+            nfCache.setLimit(bytes);
+        }
+        
+        void clearCache(){
+            nfCache.clear();
+        }
+        
+        CacheStats cacheStats(){
+            return nfCache.getStats();
+        }
+        
+        void resetCacheStats(){
+            nfCache.resetStats();
+        }
+        
+        // Work counters and phase timings (see EngineStats). They are off by default,
+        // since timing adds two clock reads to every parse, product and normal ordering.
+        void enableStats(bool on=true){
+            counters.enable(on);
+        }
+        
+        EngineStats stats(){
+            return counters.get();
+        }
+        
+        void resetStats(){
+            counters.reset();
         }
+        
         // Checks if given expression is central in lie algebra.
-        bool isCentral(Expression z){
-            string result;
-            BasisE j;
-            bool answer=true;
+        // Generators are checked in parallel, and the check stops at the first one z does not commute with.
+        bool isCentral(Expression z, int threads=0){
+            std::atomic<bool> stop(false);
+            parallelFor(size,threads,[&](size_t i){
+                if (!commutator(z,Expression(*(basis+i)),Truncation()).isZero()) stop=true;
+            },&stop);
+            return !stop.load();
+        }
+        
+        // Computes [z,x] in normal form for every basis element x, in parallel.
+        CentralityReport<C> centralResidues(Expression z, int threads=0){
+            vector<Expression> candidates(1,z);
+            return centralResidues(candidates,threads)[0];
+        }
+        
+        // Computes the residues of a batch of candidates at once. All (candidate, basis element)
+        // pairs share one pool of threads workers (0 for one per core).
+        vector<CentralityReport<C> > centralResidues(const vector<Expression>& candidates, int threads=0){
+            vector<CentralityReport<C> > reports(candidates.size());
+            for (int c=0;c<candidates.size();c++){
+                reports[c].element=candidates[c];
+                reports[c].residues.resize(size);
+            }
+            parallelFor(candidates.size()*size,threads,[&](size_t t){
+                int c=t/size, i=t%size;
+                reports[c].residues[i]=commutator(candidates[c],Expression(*(basis+i)),Truncation());
+            });
+            for (int c=0;c<candidates.size();c++){
+                reports[c].central=true;
+                for (int i=0;i<size;i++){
+                    if (!reports[c].residues[i].isZero()) reports[c].central=false;
+                }
+            }
+            return reports;
+        }
+        
+        // The ordered monomials of degree at most maxDegree, by degree and then lexicographically
+        // in the order of the basis. They span the degree maxDegree part of the PBW filtration.
+        vector<Word> pbwMonomials(int maxDegree){
+            vector<Word> ans(1);
+            size_t begin=0;
+            for (int d=1;d<=maxDegree;d++){
+                size_t end=ans.size();
+                for (size_t m=begin;m<end;m++){
+                    int first=ans[m].empty() ? 0 : rankOf(ans[m][ans[m].size()-1]);
+                    for (int i=first;i<size;i++){
+                        Word w=ans[m];
+                        w.push_back((basis+i)->id);
+                        ans.push_back(std::move(w));
+                    }
+                }
+                begin=end;
+            }
+            return ans;
+        }
+        
+        // A basis of the central elements of degree at most maxDegree: the common kernel of the
+        // matrices of ad x_i on the span of pbwMonomials(maxDegree) (see adjointAction, which builds
+        // them on threads workers, 0 for one per core), found by sparse elimination (see SparseEchelon).
+        // Every element returned has a different leading monomial, with coefficient 1, and its other
+        // monomials come before it in the order of pbwMonomials. The first element is 1. Terms are
+        // listed in the order normalOrder uses, so results compare textually with Simplify.
+        vector<Expression> center(int maxDegree, int threads=0){
+            vector<Word> monomials=pbwMonomials(maxDegree);
+            size_t n=monomials.size();
+            
+            // One equation per basis element x_i and row of ad x_i: that coefficient of [x_i,z] vanishes
+            SparseEchelon<C> echelon(n);
             for (int i=0;i<size;i++){
-                j=*(basis+i);
-                result=commutator(z,Expression(Term(j))).toString();
-                cout<<"[element,"<<j.toString()<<"] = "<<result<<endl<<endl;
-                if (result!="0") answer=false;
-            }
-            if (answer) cout<<endl<<z.toString()<<" is IN the center"<<endl;
-            else cout<<endl<<z.toString()<<" is NOT in the center"<<endl;
-            return answer;
+                std::shared_ptr<const SparseMatrix<C> > ad=adjointAction(i,maxDegree,threads);
+                for (int r=0;r<ad->rows();r++){
+                    typename SparseEchelon<C>::Row row=ad->row(r);
+                    if (!row.empty()) echelon.add(std::move(row));
+                }
+            }
+            
+            vector<typename SparseEchelon<C>::Row> kernel=echelon.kernel();
+            vector<Expression> ans(kernel.size());
+            for (int k=0;k<kernel.size();k++){
+                for (int e=kernel[k].size()-1;e>=0;e--){
+                    Term t;
+                    t.TList=monomials[kernel[k][e].first];
+                    t.coef=kernel[k][e].second;
+                    ans[k].TList.push_back(std::move(t));
+                }
+                std::sort(ans[k].TList.begin(),ans[k].TList.end(),NormalOrderLess(this));
+            }
+            return ans;
+        }
+        
+        // The matrix of ad x_i, z -> [x_i,z], from the span of pbwMonomials(d) to the span of
+        // pbwMonomials(D), where D>=d is the highest degree the brackets reach (D=d when the brackets
+        // are linear). Monomials are numbered as in pbwMonomials (see PbwIndex), and the column of a
+        // monomial holds the normal form of its bracket. The matrices of all basis elements are built
+        // together on first use, with the brackets computed by threads workers (0 for one per core),
+        // and kept until the structure constants change or clearAdjointCache is called. The matrix
+        // stays valid for as long as the returned pointer is held, even if the cache is cleared.
+        std::shared_ptr<const SparseMatrix<C> > adjointAction(int i, int d, int threads=0){
+            if (i<0 || i>=size) throw NoSuchBasis();
+            typename AdjointCache<C>::EntryPtr entry=adCache.get(d,[&](int degree, typename AdjointCache<C>::Entry& e){
+                buildAdjoint(degree,e,threads);
+            });
+            return std::shared_ptr<const SparseMatrix<C> >(entry,&entry->ad[i]);
+        }
+        
+        void clearAdjointCache(){
+            adCache.clear();
+        }
+        
+        // The coefficients of the normal form of z on pbwMonomials(d).
+        // Throws InvalidExpression if the normal form has terms of degree above d.
+        vector<C> coordinates(const Expression& z, int d){
+            return coordinatesOf(normalOrder(z),PbwIndex(size,d));
+        }
+        
+        // The expression with coefficients v on pbwMonomials(d), where v has one entry per monomial
+        // of degree at most d. Throws InvalidExpression if there is no such d.
+        Expression fromCoordinates(const vector<C>& v){
+            int d=0;
+            while (PbwIndex(size,d).count()<v.size()) d++;
+            PbwIndex index(size,d);
+            if (index.count()!=v.size()) throw InvalidExpression();
+            Expression ans;
+            for (size_t r=0;r<v.size();r++){
+                if (CoefTraits<C>::isZero(v[r])) continue;
+                vector<int> a=index.unrank(r);
+                Term t;
+                for (int k=0;k<a.size();k++) t.TList.push_back((basis+a[k])->id);
+                t.coef=v[r];
+                ans.TList.push_back(std::move(t));
+            }
+            std::sort(ans.TList.begin(),ans.TList.end(),NormalOrderLess(this));
+            return ans;
+        }
+        
+        // [x_i,z] in normal form, as a product of the cached matrix of ad x_i (see adjointAction) with
+        // the coordinates of z
+        Expression adjoint(int i, const Expression& z){
+            Expression nf=normalOrder(z);
+            int d=degreeOf(nf);
+            std::shared_ptr<const SparseMatrix<C> > ad=adjointAction(i,d);
+            return fromCoordinates(*ad*coordinatesOf(nf,PbwIndex(size,d)));
         }
 };
 
@@ -0,0 +1,216 @@
+// Benchmarks for LieAlgebra.h
+//
+// Usage: LieBench [--rational | --modp] [--json] [--max-degree d] [--min-time seconds] [files...]
+//     --rational    compute with exact rational coefficients
+//     --modp        compute modulo the prime 2^61-1
+//     --json        write a JSON array instead of CSV
+//     --max-degree  largest degree of the generated inputs (default 8)
+//     --min-time    each measurement is repeated until it has run this long (default 0.1)
+// The algebras default to sl2.txt, H_sp2n.txt and Hcn2_r0.txt.
+//
+// For every algebra and degree d = 1..max-degree, the following are measured on inputs that
+// only depend on the algebra and d, so results can be compared between versions:
+//     simplify     Simplify of a monomial of degree d
+//     commutator   commutator of two monomials of degree d
+//     multiply     Expression::operator* of the normal forms of two monomials of degree d
+//     symmetrize   Expression::symmetrize of a monomial of degree d
+//     parse        fromString of the commutator computed above
+// and checkJacobi is measured once per algebra (degree 0). The normal form cache is cleared
+// before every repetition. Each row reports the mean time, the number of heap allocations
+// and the peak heap bytes in use per repetition, the most terms held by one normal ordering
+// (EngineStats::peakTerms, from an extra untimed run) and the number of terms in the result.
+// The library takes all of its heap memory, including long words and arena chunks, from
+// operator new, so the replacement below sees every allocation.
+#include <iostream>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include "LieAlgebra.h"
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////
+////// Heap accounting
+
+static std::atomic<size_t> allocations(0);
+static std::atomic<size_t> liveBytes(0);
+static std::atomic<size_t> peakBytes(0);
+
+// Every block is preceded by its size, so that delete can update liveBytes
+static const size_t HEADER=16;
+
+void* operator new(size_t n){
+    char* p=(char*)malloc(n+HEADER);
+    if (!p) throw std::bad_alloc();
+    *(size_t*)p=n;
+    allocations++;
+    size_t live=(liveBytes+=n);
+    size_t peak=peakBytes.load();
+    while (live>peak && !peakBytes.compare_exchange_weak(peak,live)){}
+    return p+HEADER;
+}
+
+void operator delete(void* p) noexcept{
+    if (!p) return;
+    char* block=(char*)p-HEADER;
+    liveBytes-=*(size_t*)block;
+    free(block);
+}
+
+////////////////////////////////////////////////////////////////
+////// Measurements
+
+struct Measurement{
+    int iterations;
+    double seconds;
+    double allocations;
+    double peakBytes;
+    size_t peakTerms;
+    size_t terms;
+};
+
+// Runs f (which returns the number of terms of its result) until minTime has passed
+template <class C, class F>
+Measurement measure(BasicLieAlgebra<C>& g, F f, double minTime){
+    Measurement m={0,0,0,0,0,0};
+    double total=0, allocs=0, peak=0;
+    while (m.iterations==0 || (total<minTime && m.iterations<1000)){
+        size_t base=liveBytes.load();
+        peakBytes=base;
+        size_t before=allocations.load();
+        chrono::steady_clock::time_point start=chrono::steady_clock::now();
+        m.terms=f();
+        total+=chrono::duration<double>(chrono::steady_clock::now()-start).count();
+        allocs+=allocations.load()-before;
+        peak+=peakBytes.load()-base;
+        m.iterations++;
+    }
+    m.seconds=total/m.iterations;
+    m.allocations=allocs/m.iterations;
+    m.peakBytes=peak/m.iterations;
+    g.enableStats(true);
+    g.resetStats();
+    f();
+    m.peakTerms=g.stats().peakTerms;
+    g.enableStats(false);
+    return m;
+}
+
+class Report{
+    private:
+        bool json;
+        int rows;
+    public:
+        Report(bool json):json(json),rows(0){
+            if (json) cout<<"["<<endl;
+            else cout<<"ring,algebra,operation,degree,iterations,seconds,allocations,peak_bytes,peak_terms,terms"<<endl;
+        }
+
+        ~Report(){
+            if (json) cout<<endl<<"]"<<endl;
+        }
+
+        void add(const string& ring, const string& algebra, const string& operation, int degree, const Measurement& m){
+            if (json){
+                if (rows>0) cout<<","<<endl;
+                cout<<"  {\"ring\": \""<<ring<<"\", \"algebra\": \""<<algebra<<"\", \"operation\": \""<<operation
+                    <<"\", \"degree\": "<<degree<<", \"iterations\": "<<m.iterations<<", \"seconds\": "<<m.seconds
+                    <<", \"allocations\": "<<m.allocations<<", \"peak_bytes\": "<<m.peakBytes<<", \"peak_terms\": "<<m.peakTerms<<", \"terms\": "<<m.terms<<"}";
+            }
+            else{
+                cout<<ring<<","<<algebra<<","<<operation<<","<<degree<<","<<m.iterations<<","<<m.seconds<<","
+                    <<m.allocations<<","<<m.peakBytes<<","<<m.peakTerms<<","<<m.terms<<endl;
+            }
+            rows++;
+        }
+};
+
+// A monomial of degree d in basis elements chosen by a fixed pseudorandom sequence, written
+// in decreasing order so that normal ordering has to move every factor
+template <class C>
+BasicTerm<C> monomial(BasicLieAlgebra<C>& g, int d, unsigned seed){
+    vector<int> factors;
+    for (int k=0;k<d;k++){
+        seed=seed*1103515245u+12345u;
+        factors.push_back((seed>>16)%g.getSize());
+    }
+    sort(factors.rbegin(),factors.rend());
+    BasicTerm<C> t;
+    t.setCoef(C(1));
+    for (int k=0;k<d;k++) t*=g.getBasisE(factors[k]);
+    return t;
+}
+
+template <class C>
+void bench(const string& ring, const vector<string>& files, int maxDegree, double minTime, Report& report){
+    for (int f=0;f<files.size();f++){
+        BasicLieAlgebra<C> g(files[f]);
+        const string& name=files[f];
+        for (int d=1;d<=maxDegree;d++){
+            BasicExpression<C> x(monomial(g,d,d));
+            BasicExpression<C> y(monomial(g,d,d+1000));
+            report.add(ring,name,"simplify",d,measure(g,[&](){
+                g.clearCache();
+                return (size_t)g.Simplify(x).size();
+            },minTime));
+            BasicExpression<C> bracket;
+            report.add(ring,name,"commutator",d,measure(g,[&](){
+                g.clearCache();
+                bracket=g.commutator(x,y);
+                return (size_t)bracket.size();
+            },minTime));
+            BasicExpression<C> nx=g.Simplify(x), ny=g.Simplify(y);
+            report.add(ring,name,"multiply",d,measure(g,[&](){
+                return (size_t)(nx*ny).size();
+            },minTime));
+            report.add(ring,name,"symmetrize",d,measure(g,[&](){
+                return (size_t)x.symmetrize().size();
+            },minTime));
+            string text=bracket.toString();
+            report.add(ring,name,"parse",d,measure(g,[&](){
+                return (size_t)g.fromString(text).size();
+            },minTime));
+        }
+        report.add(ring,name,"checkJacobi",0,measure(g,[&](){
+            g.clearCache();
+            return (size_t)g.checkJacobi();
+        },minTime));
+    }
+}
+
+int main(int argc, char** argv){
+    string ring="double";
+    bool json=false;
+    int maxDegree=8;
+    double minTime=0.1;
+    vector<string> files;
+    for (int i=1;i<argc;i++){
+        string arg=argv[i];
+        if (arg=="--rational") ring="rational";
+        else if (arg=="--modp") ring="modp";
+        else if (arg=="--json") json=true;
+        else if (arg=="--max-degree" && i+1<argc) maxDegree=atoi(argv[++i]);
+        else if (arg=="--min-time" && i+1<argc) minTime=atof(argv[++i]);
+        else if (arg[0]!='-') files.push_back(arg);
+        else{
+            cout<<"Usage: "<<argv[0]<<" [--rational | --modp] [--json] [--max-degree d] [--min-time seconds] [files...]"<<endl;
+            return 1;
+        }
+    }
+    if (files.empty()){
+        files.push_back("sl2.txt");
+        files.push_back("H_sp2n.txt");
+        files.push_back("Hcn2_r0.txt");
+    }
+    try{
+        Report report(json);
+        if (ring=="rational") bench<Rational>(ring,files,maxDegree,minTime,report);
+        else if (ring=="modp") bench<Mod61>(ring,files,maxDegree,minTime,report);
+        else bench<double>(ring,files,maxDegree,minTime,report);
+    }
+    catch (exception& e){
+        cerr<<"Error: "<<e.what()<<endl;
+        return 1;
+    }
+    return 0;
+}
@@ -1,16 +1,57 @@
 // A simple command line interface to the functions of LieAlgebra.h
+//
+// Usage: LieCalc [--rational | --modp] [--stats] [--compile input output]
+//        LieCalc [--rational | --modp] [--stats] [-j threads] --batch algebra [commands]
+//     --rational  compute with exact rational coefficients
+//     --modp      compute modulo the prime 2^61-1
+//     --compile   convert the algebra description input into a binary file output, which
+//                 loads without parsing (binary files are recognized wherever a file is read)
+//     --batch     load algebra and run the commands in the file commands (standard input if
+//                 it is omitted or -), one per line:
+//                     commutator X Y [d | top]
+//                                     (only the terms of degree at most d, or of the top degree)
+//                     simplify X
+//                     central X
+//                     flip X i j      (i != j, both between 1 and the number of factors of the
+//                                      first term of X, in either order)
+//                     poisson X Y     (Poisson bracket in the symmetric algebra)
+//                     center d        (basis of the central elements of degree at most d)
+//                     casimir         (quadratic Casimir of the Killing form)
+//                     power X n       (X^n in normal form)
+//                     jacobi          ("ok", or the basis triples where the Jacobi identity fails)
+//                 Expressions must not contain spaces. Blank lines and lines starting with #
+//                 are skipped. Every other line produces one line of output, in input order:
+//                 the result, "central"/"not central", or "error: " and the reason.
+//     -j          number of worker threads for --batch (default: one per core)
+//     --stats     print work counters and timings (see EngineStats) after each operation,
+//                 or for all commands together in batch mode (on standard error)
+// By default coefficients are doubles.
 #include <iostream>
+#include <fstream>
 #include "LieAlgebra.h"
 
 using namespace std;
 
 
-int main(){
+// Prints the work counters of g and starts them over
+template <class C>
+void printStats(BasicLieAlgebra<C>& g, ostream& out){
+    EngineStats s=g.stats();
+    out<<"stats: normal orderings "<<s.normalOrders<<", flips "<<s.flips<<", flipwc calls "<<s.flipwcs
+       <<", rewrite steps "<<s.rewriteSteps<<", side terms "<<s.sideTerms<<", peak terms "<<s.peakTerms
+       <<", peak worklist "<<s.peakWorklist<<", parse "<<s.parseSeconds<<"s, multiply "<<s.multiplySeconds
+       <<"s, normal order "<<s.normalOrderSeconds<<"s"<<endl;
+    g.resetStats();
+}
+
+template <class C>
+int run(bool stats){
     try{
         cout<<"Enter file with algebra description"<<endl;
         string filename;
         cin>>filename;
-        LieAlgebra g(filename);
+        BasicLieAlgebra<C> g(filename);
+        g.enableStats(stats);
         cout<<endl<<"Loaded algebra in "<<filename;
         
         for (;;){
@@ -47,9 +88,10 @@ int main(){
                 int i1, i2;
                 try{
                 cin>>i1>>i2;
-                i1=i1-1;
-                i2=i2-1;
-                cout<<expr<<" = "<<g.flip(g.fromString(expr).getTerm(0),i1,i2).toString();
+                BasicExpression<C> e=g.fromString(expr);
+                if (e.isZero()) cout<<expr<<" = 0";
+                else if (min(i1,i2)<1 || max(i1,i2)>e.getTerm(0).TList.size() || i1==i2) cout<<"flip indices out of range";
+                else cout<<expr<<" = "<<g.flip(e.getTerm(0),i1-1,i2-1).toString();
                 }
                 catch (exception& e){
                       cout<<e.what();
@@ -62,7 +104,12 @@ int main(){
                    string response;
                    cout<<endl<<"Enter expression to check: ";
                    cin>>response;
-                   g.isCentral(g.fromString(response));
+                   CentralityReport<C> report=g.centralResidues(g.fromString(response));
+                   for (int i=0;i<g.getSize();i++){
+                       cout<<"[element,"<<g.getBasisE(i).toString()<<"] = "<<report.residues[i].toString()<<endl<<endl;
+                   }
+                   if (report.central) cout<<endl<<report.element.toString()<<" is IN the center"<<endl;
+                   else cout<<endl<<report.element.toString()<<" is NOT in the center"<<endl;
                }
                catch(exception& e){
                                 cout<<e.what();
@@ -81,12 +128,187 @@ int main(){
                 }
                 catch (...){cout<<"Unknown Error";}
             }
+            if (stats){
+                cout<<endl;
+                printStats(g,cout);
+            }
         }
     }
     catch (exception& e){
           cout<<endl<<"Error: "<<e.what()<<endl;
-          main();
+          run<C>(stats);
     }
     
     return 0;
 }
+
+template <class C>
+int compile(string input, string output){
+    try{
+        BasicLieAlgebra<C> g(input);
+        g.save(output);
+        cout<<"Compiled "<<input<<" to "<<output<<endl;
+    }
+    catch (exception& e){
+        cout<<"Error: "<<e.what()<<endl;
+        return 1;
+    }
+    return 0;
+}
+
+// Runs one line of a batch file and returns its line of output
+template <class C>
+string batchLine(BasicLieAlgebra<C>& g, const string& line){
+    stringstream in(line);
+    string op, x1, x2;
+    int i1, i2;
+    in>>op;
+    try{
+        if (op=="commutator" && in>>x1>>x2){
+            string mode;
+            if (!(in>>mode)) return g.commutator(g.fromString(x1),g.fromString(x2)).toString();
+            Truncation trunc(-1,true);
+            if (mode!="top"){
+                stringstream degree(mode);
+                if (!(degree>>trunc.maxDegree) || trunc.maxDegree<0) return "error: expected a degree or top after commutator X Y";
+                trunc.topDegree=false;
+            }
+            return g.commutator(g.fromString(x1),g.fromString(x2),trunc).toString();
+        }
+        if (op=="simplify" && in>>x1){
+            return g.Simplify(g.fromString(x1)).toString();
+        }
+        if (op=="central" && in>>x1){
+            return g.isCentral(g.fromString(x1),1) ? "central" : "not central";
+        }
+        if (op=="poisson" && in>>x1>>x2){
+            return g.fromPolynomial(g.poisson(g.toPolynomial(g.fromString(x1)),g.toPolynomial(g.fromString(x2)))).toString();
+        }
+        if (op=="power" && in>>x1>>i1){
+            return g.power(g.fromString(x1),i1).toString();
+        }
+        if (op=="jacobi"){
+            vector<JacobiFailure<C> > failures=g.jacobiFailures(1);
+            if (failures.empty()) return "ok";
+            string ans;
+            for (int k=0;k<failures.size();k++){
+                ans+=(k>0 ? "; " : "")+g.getBasisE(failures[k].i).toString()+","+g.getBasisE(failures[k].j).toString()
+                    +","+g.getBasisE(failures[k].k).toString()+": "+failures[k].residue.toString();
+            }
+            return ans;
+        }
+        if (op=="casimir"){
+            return g.casimir(1).toString();
+        }
+        if (op=="center" && in>>i1){
+            vector<BasicExpression<C> > center=g.center(i1,1);
+            string ans;
+            for (int k=0;k<center.size();k++) ans+=(k>0 ? "; " : "")+center[k].toString();
+            return ans;
+        }
+        if (op=="flip" && in>>x1>>i1>>i2){
+            BasicExpression<C> expr=g.fromString(x1);
+            if (expr.isZero()) return "0";
+            BasicTerm<C> t=expr.getTerm(0);
+            if (min(i1,i2)<1 || max(i1,i2)>t.TList.size() || i1==i2) return "error: flip indices out of range";
+            return g.flip(t,i1-1,i2-1).toString();
+        }
+    }
+    catch (exception& e){
+        return string("error: ")+e.what();
+    }
+    catch (...){
+        return "error: Unknown Error";
+    }
+    return "error: expected commutator X Y [d | top], simplify X, central X, flip X i j, poisson X Y, center d, casimir, power X n or jacobi";
+}
+
+// Batch mode: commands are read in chunks, each chunk is run on the worker threads and its
+// results are written before the next chunk is read. A chunk ends early when no more input
+// is buffered, so a program feeding commands through a pipe gets its answers without delay.
+template <class C>
+int batch(string filename, string commands, int threads, bool stats){
+    try{
+        BasicLieAlgebra<C> g(filename);
+        g.enableStats(stats);
+        ifstream file;
+        istream* in=&cin;
+        if (commands!="" && commands!="-"){
+            file.open(commands.c_str());
+            if (!file) throw FileNotFound();
+            in=&file;
+        }
+        if (threads<=0) threads=defaultThreads();
+        const size_t chunk=64*threads;
+        vector<string> lines, results;
+        string line;
+        bool more=true;
+        while (more){
+            lines.clear();
+            while (lines.size()<chunk){
+                if (!lines.empty() && in->rdbuf()->in_avail()<=0) break;
+                if (!getline(*in,line)){
+                    more=false;
+                    break;
+                }
+                if (!line.empty() && line[line.size()-1]=='\r') line.erase(line.size()-1);
+                size_t first=line.find_first_not_of(" \t");
+                if (first==string::npos || line[first]=='#') continue;
+                lines.push_back(line);
+            }
+            results.assign(lines.size(),"");
+            parallelFor(lines.size(),threads,[&](size_t i){
+                results[i]=batchLine(g,lines[i]);
+            });
+            for (int i=0;i<results.size();i++) cout<<results[i]<<'\n';
+            cout.flush();
+        }
+        if (stats) printStats(g,cerr);
+    }
+    catch (exception& e){
+        cout<<"Error: "<<e.what()<<endl;
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv){
+    string ring="double";
+    string input, output, algebra, commands;
+    int threads=0;
+    bool stats=false;
+    for (int i=1;i<argc;i++){
+        string arg=argv[i];
+        if (arg=="--rational") ring="rational";
+        else if (arg=="--modp") ring="modp";
+        else if (arg=="--compile" && i+2<argc){
+            input=argv[++i];
+            output=argv[++i];
+        }
+        else if (arg=="--stats") stats=true;
+        else if (arg=="-j" && i+1<argc) threads=atoi(argv[++i]);
+        else if (arg=="--batch" && i+1<argc){
+            algebra=argv[++i];
+            if (i+1<argc && (argv[i+1][0]!='-' || string(argv[i+1])=="-")) commands=argv[++i];
+        }
+        else{
+            cout<<"Usage: "<<argv[0]<<" [--rational | --modp] [--stats] [--compile input output]"<<endl;
+            cout<<"       "<<argv[0]<<" [--rational | --modp] [--stats] [-j threads] --batch algebra [commands]"<<endl;
+            return 1;
+        }
+    }
+    if (algebra!=""){
+        ios::sync_with_stdio(false);
+        if (ring=="rational") return batch<Rational>(algebra,commands,threads,stats);
+        if (ring=="modp") return batch<Mod61>(algebra,commands,threads,stats);
+        return batch<double>(algebra,commands,threads,stats);
+    }
+    if (input!=""){
+        if (ring=="rational") return compile<Rational>(input,output);
+        if (ring=="modp") return compile<Mod61>(input,output);
+        return compile<double>(input,output);
+    }
+    if (ring=="rational") return run<Rational>(stats);
+    if (ring=="modp") return run<Mod61>(stats);
+    return run<double>(stats);
+}
@@ -0,0 +1,251 @@
+/*
+    Sparse linear algebra over a coefficient ring (see Coefficients.h), for the linear problems
+    that come up in the Lie algebra library, e.g. finding the center up to a given degree.
+
+    SparseEchelon<C>
+        Row echelon form built one sparse row at a time. Every stored row has a distinct leading
+        column with coefficient 1. kernel() returns a basis of the vectors v with r.v=0 for all
+        added rows r.
+    SparseMatrix<C>
+        A matrix in compressed sparse row form, built from its columns, with matrix-vector
+        products.
+    invertMatrix(a, n)
+        Inverts the dense n*n matrix a (row-major) in place by Gauss-Jordan elimination.
+
+    Coefficients are exact for Rational and ModP. For double, entries that CoefTraits<double>
+    treats as zero are dropped after every row operation, and a row whose entries are all
+    dropped counts as dependent. invertMatrix picks the largest pivot in the column for double
+    and the first nonzero one otherwise.
+*/
+#ifndef __LINEAR_H__
+#define __LINEAR_H__
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cmath>
+#include "Coefficients.h"
+
+template <class C>
+class SparseEchelon{
+    public:
+        // Entries (column, value) in increasing column, without zero values
+        typedef std::vector<std::pair<int,C> > Row;
+
+    private:
+        int cols;
+        std::vector<int> pivot; // column -> index in rows, -1 if no row leads there
+        std::vector<Row> rows;
+
+        // r+=a*p, where neither row has zero entries
+        static void addMultiple(Row& r, C a, const Row& p){
+            Row sum;
+            sum.reserve(r.size()+p.size());
+            typename Row::const_iterator i=r.begin(), j=p.begin();
+            while (i!=r.end() || j!=p.end()){
+                if (j==p.end() || (i!=r.end() && i->first<j->first)){
+                    sum.push_back(*i++);
+                    continue;
+                }
+                C v=a*j->second;
+                int c=j->first;
+                if (i!=r.end() && i->first==c) v+=(i++)->second;
+                j++;
+                if (!CoefTraits<C>::isZero(v)) sum.push_back(std::make_pair(c,v));
+            }
+            r.swap(sum);
+        }
+
+    public:
+        explicit SparseEchelon(int cols):cols(cols),pivot(cols,-1){}
+
+        int columns() const{
+            return cols;
+        }
+
+        // Number of independent rows added so far
+        int rank() const{
+            return rows.size();
+        }
+
+        // Reduces r by the stored rows and keeps it if anything is left.
+        // Returns whether r was independent of the rows added before.
+        bool add(Row r){
+            while (!r.empty()){
+                int lead=r.front().first;
+                int k=pivot[lead];
+                if (k<0){
+                    C inv=C(1)/r.front().second;
+                    for (int e=0;e<r.size();e++) r[e].second*=inv;
+                    r.front().second=C(1);
+                    pivot[lead]=rows.size();
+                    rows.push_back(std::move(r));
+                    return true;
+                }
+                C a=-r.front().second;
+                addMultiple(r,a,rows[k]);
+                if (!r.empty() && r.front().first==lead) r.erase(r.begin());
+            }
+            return false;
+        }
+
+        // A basis of the kernel, one vector for every column f without a leading entry. The vector
+        // for f has coefficient 1 at f and is otherwise supported on leading columns before f.
+        std::vector<Row> kernel() const{
+            // Reduced row echelon form, working from the last leading column back
+            std::vector<Row> reduced(rows.size());
+            for (int c=cols-1;c>=0;c--){
+                int k=pivot[c];
+                if (k<0) continue;
+                Row r=rows[k];
+                for (int e=1;e<rows[k].size();e++){
+                    int j=pivot[rows[k][e].first];
+                    if (j>=0) addMultiple(r,-rows[k][e].second,reduced[j]);
+                }
+                reduced[k].swap(r);
+            }
+            std::vector<Row> basis(cols);
+            for (int k=0;k<reduced.size();k++){
+                int lead=reduced[k].front().first;
+                for (int e=1;e<reduced[k].size();e++){
+                    basis[reduced[k][e].first].push_back(std::make_pair(lead,-reduced[k][e].second));
+                }
+            }
+            std::vector<Row> ans;
+            for (int f=0;f<cols;f++){
+                if (pivot[f]>=0) continue;
+                Row v;
+                v.swap(basis[f]);
+                v.push_back(std::make_pair(f,C(1)));
+                std::sort(v.begin(),v.end(),[](const std::pair<int,C>& a, const std::pair<int,C>& b){
+                    return a.first<b.first;
+                });
+                ans.push_back(std::move(v));
+            }
+            return ans;
+        }
+};
+
+template <class C>
+class SparseMatrix{
+    private:
+        int nrows, ncols;
+        std::vector<size_t> start; // row r has the entries start[r]..start[r+1]-1
+        std::vector<int> col;
+        std::vector<C> value;
+
+    public:
+        SparseMatrix():nrows(0),ncols(0),start(1,0){}
+
+        // The rows*columns.size() matrix whose column j has the entries columns[j], given as
+        // (row, value) pairs with distinct rows. Entries within a row end up in increasing column.
+        SparseMatrix(int rows, const std::vector<std::vector<std::pair<int,C> > >& columns):nrows(rows),ncols(columns.size()){
+            start.assign(nrows+1,0);
+            for (int j=0;j<ncols;j++){
+                for (size_t e=0;e<columns[j].size();e++) start[columns[j][e].first+1]++;
+            }
+            for (int r=0;r<nrows;r++) start[r+1]+=start[r];
+            col.resize(start[nrows]);
+            value.resize(start[nrows]);
+            std::vector<size_t> next(start.begin(),start.end()-1);
+            for (int j=0;j<ncols;j++){
+                for (size_t e=0;e<columns[j].size();e++){
+                    size_t k=next[columns[j][e].first]++;
+                    col[k]=j;
+                    value[k]=columns[j][e].second;
+                }
+            }
+        }
+
+        int rows() const{
+            return nrows;
+        }
+
+        int columns() const{
+            return ncols;
+        }
+
+        // Number of stored entries
+        size_t nonzeros() const{
+            return value.size();
+        }
+
+        // Entries of row r, as (column, value) pairs in increasing column
+        std::vector<std::pair<int,C> > row(int r) const{
+            std::vector<std::pair<int,C> > ans;
+            ans.reserve(start[r+1]-start[r]);
+            for (size_t k=start[r];k<start[r+1];k++) ans.push_back(std::make_pair(col[k],value[k]));
+            return ans;
+        }
+
+        // out = A*v, for v with columns() entries. Zero entries of v are skipped, which matters
+        // for exact coefficients, where every product costs a normalization.
+        void multiply(const std::vector<C>& v, std::vector<C>& out) const{
+            out.assign(nrows,C(0));
+            for (int r=0;r<nrows;r++){
+                C& sum=out[r];
+                for (size_t k=start[r];k<start[r+1];k++){
+                    const C& x=v[col[k]];
+                    if (!CoefTraits<C>::isZero(x)) sum+=value[k]*x;
+                }
+            }
+        }
+
+        std::vector<C> operator*(const std::vector<C>& v) const{
+            std::vector<C> out;
+            multiply(v,out);
+            return out;
+        }
+};
+
+// Whether a is a better pivot than b; exact rings take the first nonzero entry
+template <class C>
+inline bool betterPivot(const C&, const C&){
+    return false;
+}
+
+template <>
+inline bool betterPivot<double>(const double& a, const double& b){
+    return fabs(a)>fabs(b);
+}
+
+// Replaces the n*n matrix a (row-major) by its inverse. Returns false, leaving a in an
+// unspecified state, if a is singular.
+template <class C>
+bool invertMatrix(std::vector<C>& a, int n){
+    std::vector<C> inv((size_t)n*n,C(0));
+    for (int i=0;i<n;i++) inv[(size_t)i*n+i]=C(1);
+    for (int col=0;col<n;col++){
+        int p=-1;
+        for (int r=col;r<n;r++){
+            const C& v=a[(size_t)r*n+col];
+            if (CoefTraits<C>::isZero(v)) continue;
+            if (p<0 || betterPivot(v,a[(size_t)p*n+col])) p=r;
+        }
+        if (p<0) return false;
+        if (p!=col){
+            for (int k=0;k<n;k++){
+                std::swap(a[(size_t)p*n+k],a[(size_t)col*n+k]);
+                std::swap(inv[(size_t)p*n+k],inv[(size_t)col*n+k]);
+            }
+        }
+        C scale=C(1)/a[(size_t)col*n+col];
+        for (int k=0;k<n;k++){
+            a[(size_t)col*n+k]*=scale;
+            inv[(size_t)col*n+k]*=scale;
+        }
+        for (int r=0;r<n;r++){
+            if (r==col) continue;
+            C f=a[(size_t)r*n+col];
+            if (CoefTraits<C>::isZero(f)) continue;
+            for (int k=0;k<n;k++){
+                a[(size_t)r*n+k]-=f*a[(size_t)col*n+k];
+                inv[(size_t)r*n+k]-=f*inv[(size_t)col*n+k];
+            }
+        }
+    }
+    a.swap(inv);
+    return true;
+}
+
+#endif
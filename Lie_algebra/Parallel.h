@@ -0,0 +1,62 @@
+/*
+    Minimal thread helpers for the Lie algebra library.
+
+    parallelFor(n, threads, f)
+        Calls f(i) for every i in [0,n) using a pool of worker threads. Indices are handed out
+        one at a time, so uneven work items balance themselves. threads<=0 uses one thread
+        per hardware core. If a call throws, remaining indices are skipped and the first
+        exception is rethrown in the calling thread.
+*/
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <exception>
+
+inline int defaultThreads(){
+    int n=std::thread::hardware_concurrency();
+    return n>0 ? n : 1;
+}
+
+// Calls f(i) for i in [0,n) on up to threads threads (see above).
+// If stop is given, workers stop picking up new indices once it is set.
+template <class F>
+void parallelFor(size_t n, int threads, F f, const std::atomic<bool>* stop=0){
+    if (threads<=0) threads=defaultThreads();
+    if ((size_t)threads>n) threads=n;
+    std::atomic<size_t> next(0);
+    std::atomic<bool> failed(false);
+    std::exception_ptr error;
+    std::mutex errorLock;
+
+    auto worker=[&](){
+        for (;;){
+            if (failed.load() || (stop && stop->load())) return;
+            size_t i=next++;
+            if (i>=n) return;
+            try{
+                f(i);
+            }
+            catch(...){
+                std::lock_guard<std::mutex> guard(errorLock);
+                if (!error) error=std::current_exception();
+                failed=true;
+            }
+        }
+    };
+
+    if (threads<=1){
+        worker();
+    }
+    else{
+        std::vector<std::thread> pool;
+        for (int t=0;t<threads;t++) pool.push_back(std::thread(worker));
+        for (int t=0;t<threads;t++) pool[t].join();
+    }
+    if (error) std::rethrow_exception(error);
+}
+
+#endif
@@ -0,0 +1,378 @@
+/*
+    Commutative polynomials, for computations in the symmetric algebra S(g) of a Lie algebra.
+
+    Monomial
+        The exponent vector of x_0^a_0 ... x_{n-1}^a_{n-1}, packed four 16-bit exponents to a
+        64-bit word, so a product of monomials is one addition per word. Monomials in up to
+        16 variables need no allocation.
+    BasicPolynomial<C>
+        A sum of monomials in a fixed number of variables with coefficients in C (see
+        Coefficients.h), kept in a hash table from monomial to nonzero coefficient.
+        Polynomial is BasicPolynomial<double>.
+
+    BasicLieAlgebra converts between expressions and polynomials in the variables x_i = basis
+    element i (toPolynomial, fromPolynomial) and computes Poisson brackets of polynomials from
+    its structure constants (poisson).
+*/
+#ifndef __POLYNOMIAL_H__
+#define __POLYNOMIAL_H__
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <exception>
+#include <new>
+#include <cstring>
+#include <stdint.h>
+#include "Coefficients.h"
+
+class ExponentOverflow: public std::exception{
+    public:
+        virtual const char* what() const throw(){
+            return "Exponent too large (at most 65535)";
+        }
+};
+
+class VariableMismatch: public std::exception{
+    public:
+        virtual const char* what() const throw(){
+            return "Polynomials in different numbers of variables";
+        }
+};
+
+////////////////////////////////////////////////////////////////
+////// Monomials
+
+class Monomial{
+    private:
+        static const int INLINE_WORDS=4;
+        static const int FIELD_BITS=16;
+        static const int FIELDS=64/FIELD_BITS;
+        static const uint64_t FIELD_MASK=0xFFFF;
+        // The lowest bit of every field but the first; a carry out of a field shows up there
+        static const uint64_t CARRY_BITS=0x0001000100010000ULL;
+
+        uint64_t *data;
+        int words;
+        int deg;
+        uint64_t buf[INLINE_WORDS];
+
+        void allocate(int n){
+            words=n;
+            data=n>INLINE_WORDS ? (uint64_t*)::operator new(sizeof(uint64_t)*n) : buf;
+        }
+
+        void release(){
+            if (data!=buf) ::operator delete(data);
+            data=buf;
+            words=0;
+        }
+
+    public:
+        // The monomial 1 in nvars variables
+        explicit Monomial(int nvars=0):deg(0){
+            allocate((nvars+FIELDS-1)/FIELDS);
+            memset(data,0,sizeof(uint64_t)*words);
+        }
+
+        Monomial(const Monomial& rhs):deg(rhs.deg){
+            allocate(rhs.words);
+            memcpy(data,rhs.data,sizeof(uint64_t)*words);
+        }
+
+        Monomial(Monomial&& rhs):data(buf),words(0),deg(0){
+            *this=std::move(rhs);
+        }
+
+        ~Monomial(){
+            release();
+        }
+
+        Monomial& operator=(const Monomial& rhs){
+            if (this==&rhs) return *this;
+            if (words!=rhs.words){
+                release();
+                allocate(rhs.words);
+            }
+            memcpy(data,rhs.data,sizeof(uint64_t)*words);
+            deg=rhs.deg;
+            return *this;
+        }
+
+        Monomial& operator=(Monomial&& rhs){
+            if (this==&rhs) return *this;
+            if (rhs.data==rhs.buf) return *this=(const Monomial&)rhs;
+            release();
+            data=rhs.data;
+            words=rhs.words;
+            deg=rhs.deg;
+            rhs.data=rhs.buf;
+            rhs.words=0;
+            rhs.deg=0;
+            return *this;
+        }
+
+        // Total degree
+        int degree() const{
+            return deg;
+        }
+
+        int exponent(int i) const{
+            return (data[i/FIELDS]>>(FIELD_BITS*(i%FIELDS)))&FIELD_MASK;
+        }
+
+        // Multiplies by x_i^e
+        void multiplyVariable(int i, int e=1){
+            if (exponent(i)+e>(int)FIELD_MASK) throw ExponentOverflow();
+            data[i/FIELDS]+=(uint64_t)e<<(FIELD_BITS*(i%FIELDS));
+            deg+=e;
+        }
+
+        // Divides by x_i, which must divide the monomial
+        void divideVariable(int i){
+            data[i/FIELDS]-=(uint64_t)1<<(FIELD_BITS*(i%FIELDS));
+            deg--;
+        }
+
+        Monomial& operator*=(const Monomial& rhs){
+            for (int k=0;k<words;k++){
+                uint64_t a=data[k], b=rhs.data[k], s=a+b;
+                if (s<a || ((a^b^s)&CARRY_BITS)) throw ExponentOverflow();
+                data[k]=s;
+            }
+            deg+=rhs.deg;
+            return *this;
+        }
+
+        Monomial operator*(const Monomial& rhs) const{
+            Monomial m(*this);
+            m*=rhs;
+            return m;
+        }
+
+        bool operator==(const Monomial& rhs) const{
+            if (deg!=rhs.deg || words!=rhs.words) return false;
+            return memcmp(data,rhs.data,sizeof(uint64_t)*words)==0;
+        }
+
+        bool operator!=(const Monomial& rhs) const{
+            return !(*this==rhs);
+        }
+
+        // Graded lexicographic order: higher degree first, then the larger exponent of x_0,
+        // then of x_1, and so on
+        bool operator<(const Monomial& rhs) const{
+            if (deg!=rhs.deg) return deg>rhs.deg;
+            for (int k=0;k<words;k++){
+                if (data[k]==rhs.data[k]) continue;
+                for (int f=0;f<FIELDS;f++){
+                    int a=(data[k]>>(FIELD_BITS*f))&FIELD_MASK, b=(rhs.data[k]>>(FIELD_BITS*f))&FIELD_MASK;
+                    if (a!=b) return a>b;
+                }
+            }
+            return false;
+        }
+
+        size_t hash() const{
+            uint64_t h=(uint64_t)deg*0x9E3779B97F4A7C15ULL;
+            for (int k=0;k<words;k++){
+                h^=data[k]+0x9E3779B97F4A7C15ULL+(h<<6)+(h>>2);
+            }
+            return (size_t)h;
+        }
+};
+
+struct MonomialHash{
+    size_t operator()(const Monomial& m) const{
+        return m.hash();
+    }
+};
+
+////////////////////////////////////////////////////////////////
+////// Polynomials
+
+template <class C>
+class BasicPolynomial{
+    public:
+        typedef std::unordered_map<Monomial,C,MonomialHash> TermMap;
+        typedef typename TermMap::const_iterator const_iterator;
+
+    private:
+        int nvars;
+        TermMap terms;
+
+        // A zero polynomial made without a number of variables takes that of the other operand
+        void match(const BasicPolynomial& rhs){
+            if (nvars==rhs.nvars) return;
+            if (nvars==0 && terms.empty()) nvars=rhs.nvars;
+            else if (!(rhs.nvars==0 && rhs.terms.empty())) throw VariableMismatch();
+        }
+
+    public:
+        explicit BasicPolynomial(int nvars=0):nvars(nvars){}
+
+        // The polynomial x_i
+        static BasicPolynomial variable(int nvars, int i){
+            BasicPolynomial p(nvars);
+            Monomial m(nvars);
+            m.multiplyVariable(i);
+            p.terms[m]=C(1);
+            return p;
+        }
+
+        // The constant c
+        static BasicPolynomial constant(int nvars, C c){
+            BasicPolynomial p(nvars);
+            p.add(Monomial(nvars),c);
+            return p;
+        }
+
+        int variables() const{
+            return nvars;
+        }
+
+        // Number of terms
+        size_t size() const{
+            return terms.size();
+        }
+
+        bool isZero() const{
+            return terms.empty();
+        }
+
+        // Total degree, -1 for the zero polynomial
+        int degree() const{
+            int d=-1;
+            for (const_iterator it=terms.begin();it!=terms.end();it++) d=std::max(d,it->first.degree());
+            return d;
+        }
+
+        const_iterator begin() const{
+            return terms.begin();
+        }
+
+        const_iterator end() const{
+            return terms.end();
+        }
+
+        C coefficient(const Monomial& m) const{
+            const_iterator it=terms.find(m);
+            return it==terms.end() ? C(0) : it->second;
+        }
+
+        // Adds c*m
+        void add(const Monomial& m, C c){
+            if (CoefTraits<C>::isZero(c)) return;
+            typename TermMap::iterator it=terms.find(m);
+            if (it==terms.end()){
+                terms.insert(std::make_pair(m,c));
+                return;
+            }
+            it->second+=c;
+            if (CoefTraits<C>::isZero(it->second)) terms.erase(it);
+        }
+
+        // The terms sorted by Monomial::operator<, for output that does not depend on hashing
+        std::vector<std::pair<Monomial,C> > sortedTerms() const{
+            std::vector<std::pair<Monomial,C> > v(terms.begin(),terms.end());
+            std::sort(v.begin(),v.end(),[](const std::pair<Monomial,C>& a, const std::pair<Monomial,C>& b){
+                return a.first<b.first;
+            });
+            return v;
+        }
+
+        BasicPolynomial& operator+=(const BasicPolynomial& rhs){
+            match(rhs);
+            for (const_iterator it=rhs.terms.begin();it!=rhs.terms.end();it++) add(it->first,it->second);
+            return *this;
+        }
+
+        BasicPolynomial& operator-=(const BasicPolynomial& rhs){
+            match(rhs);
+            for (const_iterator it=rhs.terms.begin();it!=rhs.terms.end();it++) add(it->first,-it->second);
+            return *this;
+        }
+
+        BasicPolynomial& operator*=(C c){
+            if (CoefTraits<C>::isZero(c)){
+                terms.clear();
+                return *this;
+            }
+            for (typename TermMap::iterator it=terms.begin();it!=terms.end();it++) it->second*=c;
+            return *this;
+        }
+
+        // Adds a*b to the polynomial, without forming a*b separately
+        void addProduct(const BasicPolynomial& a, const BasicPolynomial& b){
+            match(a);
+            match(b);
+            terms.reserve(terms.size()+a.terms.size()*b.terms.size());
+            for (const_iterator i=a.terms.begin();i!=a.terms.end();i++){
+                for (const_iterator j=b.terms.begin();j!=b.terms.end();j++){
+                    add(i->first*j->first,i->second*j->second);
+                }
+            }
+        }
+
+        BasicPolynomial& operator*=(const BasicPolynomial& rhs){
+            BasicPolynomial p(nvars);
+            p.addProduct(*this,rhs);
+            return *this=std::move(p);
+        }
+
+        BasicPolynomial operator+(const BasicPolynomial& rhs) const{
+            BasicPolynomial p(*this);
+            return p+=rhs;
+        }
+
+        BasicPolynomial operator-(const BasicPolynomial& rhs) const{
+            BasicPolynomial p(*this);
+            return p-=rhs;
+        }
+
+        BasicPolynomial operator-() const{
+            BasicPolynomial p(*this);
+            return p*=C(-1);
+        }
+
+        BasicPolynomial operator*(const BasicPolynomial& rhs) const{
+            BasicPolynomial p(nvars);
+            p.addProduct(*this,rhs);
+            return p;
+        }
+
+        BasicPolynomial operator*(C c) const{
+            BasicPolynomial p(*this);
+            return p*=c;
+        }
+
+        bool operator==(const BasicPolynomial& rhs) const{
+            if (terms.size()!=rhs.terms.size()) return false;
+            for (const_iterator it=terms.begin();it!=terms.end();it++){
+                const_iterator jt=rhs.terms.find(it->first);
+                if (jt==rhs.terms.end() || jt->second!=it->second) return false;
+            }
+            return true;
+        }
+
+        bool operator!=(const BasicPolynomial& rhs) const{
+            return !(*this==rhs);
+        }
+
+        // Partial derivative with respect to x_i
+        BasicPolynomial derivative(int i) const{
+            BasicPolynomial p(nvars);
+            for (const_iterator it=terms.begin();it!=terms.end();it++){
+                int e=it->first.exponent(i);
+                if (e==0) continue;
+                Monomial m(it->first);
+                m.divideVariable(i);
+                p.add(m,it->second*C(e));
+            }
+            return p;
+        }
+};
+
+typedef BasicPolynomial<double> Polynomial;
+
+#endif